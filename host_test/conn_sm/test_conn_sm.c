@@ -0,0 +1,96 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdio.h>
+
+#include "conn_sm.h"
+
+static int s_failures;
+
+static void expect(conn_state_t state, conn_event_id_t event, conn_state_t want) {
+  conn_state_t got = conn_sm_next(state, event);
+  if (got != want) {
+    printf("FAIL %s + event %d: got %s, want %s\n",
+           conn_state_name(state), event, conn_state_name(got), conn_state_name(want));
+    s_failures++;
+  }
+}
+
+static void test_session_cycle(void) {
+  expect(CONN_OFFLINE, CONN_EV_SCAN_DONE, CONN_ASSOCIATING);
+  expect(CONN_OFFLINE, CONN_EV_PROVISIONED, CONN_ASSOCIATING);
+  expect(CONN_ASSOCIATING, CONN_EV_GOT_IP, CONN_IP);
+  // Wired and simulated links have no association step
+  expect(CONN_OFFLINE, CONN_EV_GOT_IP, CONN_IP);
+  expect(CONN_IP, CONN_EV_MQTT_CONNECTED, CONN_MQTT_READY);
+  expect(CONN_MQTT_READY, CONN_EV_MQTT_PUBLISHED, CONN_DRAINING);
+  expect(CONN_DRAINING, CONN_EV_DRAINED, CONN_IP);
+}
+
+static void test_session_failures(void) {
+  expect(CONN_IP, CONN_EV_MQTT_DISCONNECTED, CONN_DRAINING);
+  expect(CONN_IP, CONN_EV_MQTT_ERROR, CONN_DRAINING);
+  expect(CONN_MQTT_READY, CONN_EV_MQTT_DISCONNECTED, CONN_DRAINING);
+  expect(CONN_MQTT_READY, CONN_EV_MQTT_ERROR, CONN_DRAINING);
+}
+
+static void test_link_loss(void) {
+  // A link that is not up yet has nothing to lose
+  expect(CONN_OFFLINE, CONN_EV_DISCONNECTED, CONN_OFFLINE);
+  for (conn_state_t state = CONN_ASSOCIATING; state < CONN_STATE_COUNT; state++) {
+    expect(state, CONN_EV_DISCONNECTED, CONN_ASSOCIATING);
+  }
+}
+
+static void test_ignored_events(void) {
+  // Events that are handled by the task without a state change
+  static const conn_event_id_t ignored[] = {
+    CONN_EV_WIFI_START, CONN_EV_ASSOCIATED, CONN_EV_RSSI_LOW, CONN_EV_SC_DONE,
+    CONN_EV_LINK_RETRY, CONN_EV_SAMPLE_DUE, CONN_EV_SAMPLE_READY, CONN_EV_OTA_DONE,
+  };
+  for (conn_state_t state = CONN_OFFLINE; state < CONN_STATE_COUNT; state++) {
+    for (size_t i = 0; i < sizeof(ignored) / sizeof(ignored[0]); i++) {
+      expect(state, ignored[i], state);
+    }
+  }
+
+  // Events that belong to another state
+  expect(CONN_OFFLINE, CONN_EV_MQTT_CONNECTED, CONN_OFFLINE);
+  expect(CONN_OFFLINE, CONN_EV_DRAINED, CONN_OFFLINE);
+  expect(CONN_ASSOCIATING, CONN_EV_MQTT_CONNECTED, CONN_ASSOCIATING);
+  expect(CONN_ASSOCIATING, CONN_EV_SCAN_DONE, CONN_ASSOCIATING);
+  expect(CONN_IP, CONN_EV_MQTT_PUBLISHED, CONN_IP);
+  expect(CONN_IP, CONN_EV_GOT_IP, CONN_IP);
+  expect(CONN_IP, CONN_EV_DRAINED, CONN_IP);
+  expect(CONN_MQTT_READY, CONN_EV_MQTT_CONNECTED, CONN_MQTT_READY);
+  expect(CONN_MQTT_READY, CONN_EV_GOT_IP, CONN_MQTT_READY);
+  expect(CONN_DRAINING, CONN_EV_MQTT_PUBLISHED, CONN_DRAINING);
+  expect(CONN_DRAINING, CONN_EV_MQTT_CONNECTED, CONN_DRAINING);
+  expect(CONN_DRAINING, CONN_EV_MQTT_ERROR, CONN_DRAINING);
+}
+
+int main(void) {
+  test_session_cycle();
+  test_session_failures();
+  test_link_loss();
+  test_ignored_events();
+  if (s_failures) {
+    printf("%d transition(s) failed\n", s_failures);
+    return 1;
+  }
+  printf("All transitions passed\n");
+  return 0;
+}
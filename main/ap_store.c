@@ -0,0 +1,190 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "ap_store.h"
+
+#define AP_STORE_NAMESPACE      "ap_store"
+#define AP_STORE_KEY            "aps"
+
+// Latency above which an AP starts losing score, and the cap on that penalty
+#define AP_LATENCY_FREE_MS      1000
+#define AP_LATENCY_STEP_MS      500
+#define AP_LATENCY_MAX_PENALTY  10
+
+static ap_entry_t s_aps[AP_STORE_MAX_ENTRIES];
+static int s_ap_count;
+
+static const char *TAG = "FOSSOR";
+
+static void ap_store_save(void) {
+  nvs_handle_t nvs;
+  if (nvs_open(AP_STORE_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+    ESP_LOGE(TAG, "AP STORE NOT OPENED");
+    return;
+  }
+  esp_err_t err = nvs_set_blob(nvs, AP_STORE_KEY, s_aps, s_ap_count * sizeof(ap_entry_t));
+  if (err == ESP_OK) {
+    err = nvs_commit(nvs);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "AP STORE NOT SAVED [%s]", esp_err_to_name(err));
+  }
+  nvs_close(nvs);
+}
+
+esp_err_t ap_store_load(void) {
+  nvs_handle_t nvs;
+  s_ap_count = 0;
+  esp_err_t err = nvs_open(AP_STORE_NAMESPACE, NVS_READONLY, &nvs);
+  if (err == ESP_ERR_NVS_NOT_FOUND) {
+    return ESP_OK;
+  } else if (err != ESP_OK) {
+    return err;
+  }
+
+  size_t len = sizeof(s_aps);
+  err = nvs_get_blob(nvs, AP_STORE_KEY, s_aps, &len);
+  nvs_close(nvs);
+  if (err == ESP_ERR_NVS_NOT_FOUND) {
+    return ESP_OK;
+  } else if (err != ESP_OK || len % sizeof(ap_entry_t) != 0) {
+    // Layout changed or blob is larger than the configured maximum
+    ESP_LOGW(TAG, "AP STORE DISCARDED");
+    return ESP_OK;
+  }
+  s_ap_count = len / sizeof(ap_entry_t);
+  ESP_LOGI(TAG, "AP STORE LOADED [%d]", s_ap_count);
+  return ESP_OK;
+}
+
+// Score history so that unknown APs sit in the middle: -10..+10
+static int ap_history_score(const ap_entry_t *ap) {
+  int attempts = ap->successes + ap->failures;
+  int bonus = (20 * (ap->successes + 1)) / (attempts + 2) - 10;
+  int penalty = 0;
+  if (ap->successes > 0 && ap->connect_ms > AP_LATENCY_FREE_MS) {
+    penalty = (ap->connect_ms - AP_LATENCY_FREE_MS) / AP_LATENCY_STEP_MS;
+    if (penalty > AP_LATENCY_MAX_PENALTY) {
+      penalty = AP_LATENCY_MAX_PENALTY;
+    }
+  }
+  return bonus - penalty;
+}
+
+int ap_store_find(const uint8_t *ssid) {
+  for (int i = 0; i < s_ap_count; i++) {
+    if (strncmp((const char *)s_aps[i].ssid, (const char *)ssid, sizeof(s_aps[i].ssid)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int ap_store_add(const uint8_t *ssid, const uint8_t *password) {
+  int index = ap_store_find(ssid);
+
+  if (index < 0 && s_ap_count < AP_STORE_MAX_ENTRIES) {
+    index = s_ap_count++;
+    memset(&s_aps[index], 0, sizeof(ap_entry_t));
+  } else if (index < 0) {
+    // Store is full, replace the AP with the worst history
+    index = 0;
+    for (int i = 1; i < s_ap_count; i++) {
+      if (ap_history_score(&s_aps[i]) < ap_history_score(&s_aps[index])) {
+        index = i;
+      }
+    }
+    ESP_LOGW(TAG, "AP STORE FULL, REPLACING %s", s_aps[index].ssid);
+    memset(&s_aps[index], 0, sizeof(ap_entry_t));
+  }
+
+  strncpy((char *)s_aps[index].ssid, (const char *)ssid, sizeof(s_aps[index].ssid) - 1);
+  strncpy((char *)s_aps[index].password, (const char *)password, sizeof(s_aps[index].password) - 1);
+  ap_store_save();
+  return index;
+}
+
+int ap_store_count(void) {
+  return s_ap_count;
+}
+
+const ap_entry_t *ap_store_get(int index) {
+  if (index < 0 || index >= s_ap_count) {
+    return NULL;
+  }
+  return &s_aps[index];
+}
+
+void ap_store_record_result(int index, bool success, uint32_t connect_ms) {
+  if (index < 0 || index >= s_ap_count) {
+    return;
+  }
+  ap_entry_t *ap = &s_aps[index];
+  if (success) {
+    ap->connect_ms = ap->successes == 0 ? connect_ms : (ap->connect_ms * 3 + connect_ms) / 4;
+    if (ap->successes < UINT16_MAX) {
+      ap->successes++;
+    }
+  } else if (ap->failures < UINT16_MAX) {
+    ap->failures++;
+  }
+
+  // Halve old history so an AP that was fixed or moved can recover
+  if (ap->successes + ap->failures > 64) {
+    ap->successes /= 2;
+    ap->failures /= 2;
+  }
+  if (success) {
+    ap_store_save();
+  }
+}
+
+int ap_store_rank(const wifi_ap_record_t *records, uint16_t record_count,
+                  ap_candidate_t *out, int max_out) {
+  int n = 0;
+  for (uint16_t r = 0; r < record_count; r++) {
+    for (int i = 0; i < s_ap_count; i++) {
+      if (strncmp((const char *)records[r].ssid, (const char *)s_aps[i].ssid, sizeof(s_aps[i].ssid)) != 0) {
+        continue;
+      }
+      ap_candidate_t c = {
+        .index = i,
+        .channel = records[r].primary,
+        .rssi = records[r].rssi,
+        .score = records[r].rssi + ap_history_score(&s_aps[i]),
+      };
+      memcpy(c.bssid, records[r].bssid, sizeof(c.bssid));
+
+      // Insertion sort, best score first
+      int pos = n < max_out ? n++ : max_out;
+      while (pos > 0 && out[pos - 1].score < c.score) {
+        if (pos < max_out) {
+          out[pos] = out[pos - 1];
+        }
+        pos--;
+      }
+      if (pos < max_out) {
+        out[pos] = c;
+      }
+      break;
+    }
+  }
+  return n;
+}
@@ -0,0 +1,63 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_wifi_types.h"
+
+#define AP_STORE_MAX_ENTRIES    CONFIG_AP_STORE_MAX_ENTRIES
+
+// One remembered access point plus its connection history
+typedef struct {
+  uint8_t ssid[33];
+  uint8_t password[65];
+  uint16_t successes;
+  uint16_t failures;
+  uint32_t connect_ms;    // Smoothed association-to-IP latency
+} ap_entry_t;
+
+// A stored AP that was seen in the last scan
+typedef struct {
+  int index;              // Index into the store
+  uint8_t bssid[6];
+  uint8_t channel;
+  int8_t rssi;
+  int score;
+} ap_candidate_t;
+
+// Load the AP list from NVS. Must run after nvs_flash_init().
+esp_err_t ap_store_load(void);
+
+// Add or update an AP. Returns its index, or -1 on failure.
+int ap_store_add(const uint8_t *ssid, const uint8_t *password);
+
+// Index of a stored SSID, or -1
+int ap_store_find(const uint8_t *ssid);
+
+int ap_store_count(void);
+const ap_entry_t *ap_store_get(int index);
+
+// Record the outcome of a connection attempt. Only a success is written
+// to NVS, together with the failures before it, so an AP that keeps
+// failing does not wear the flash.
+void ap_store_record_result(int index, bool success, uint32_t connect_ms);
+
+// Match scan results against the store and rank them best first
+int ap_store_rank(const wifi_ap_record_t *records, uint16_t record_count,
+                  ap_candidate_t *out, int max_out);
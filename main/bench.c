@@ -0,0 +1,244 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+
+#include "bench.h"
+#include "connectivity.h"
+#include "entropy_health.h"
+#include "sample_arena.h"
+#include "sampler.h"
+#include "spsc_ring.h"
+
+#ifdef CONFIG_BENCH_MODE
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <time.h>
+#define BENCH_UNIT              "ns"
+#else
+#include "esp_cpu.h"
+#define BENCH_UNIT              "cycles"
+#endif
+
+#define BENCH_WARMUP            16
+#define PIPELINE_SAMPLES        2000
+
+typedef void (*bench_fn_t)(void);
+
+static uint32_t s_times[CONFIG_BENCH_ITERATIONS];
+static uint8_t s_buf[1024];
+static uint8_t s_digest[32];
+static sample_slot_t s_slot;
+static volatile uint32_t s_sink;        // Keeps results from being optimised out
+
+static inline uint32_t bench_now(void) {
+  #ifdef CONFIG_IDF_TARGET_LINUX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+  #else
+    return esp_cpu_get_cycle_count();
+  #endif
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench(const char *name, bench_fn_t fn, uint32_t bytes) {
+  for (int i = 0; i < BENCH_WARMUP; i++) {
+    fn();
+  }
+  uint64_t total = 0;
+  for (int i = 0; i < CONFIG_BENCH_ITERATIONS; i++) {
+    uint32_t start = bench_now();
+    fn();
+    s_times[i] = bench_now() - start;
+    total += s_times[i];
+  }
+  qsort(s_times, CONFIG_BENCH_ITERATIONS, sizeof(s_times[0]), compare_u32);
+
+  printf("BENCH {\"name\":\"%s\",\"unit\":\"" BENCH_UNIT "\",\"n\":%d,\"min\":%lu,\"median\":%lu,"
+         "\"p99\":%lu,\"mean\":%lu,\"bytes\":%lu}\n",
+         name, CONFIG_BENCH_ITERATIONS, (unsigned long)s_times[0],
+         (unsigned long)s_times[CONFIG_BENCH_ITERATIONS / 2],
+         (unsigned long)s_times[CONFIG_BENCH_ITERATIONS * 99 / 100],
+         (unsigned long)(total / CONFIG_BENCH_ITERATIONS), (unsigned long)bytes);
+}
+
+// Timing and call overhead, to subtract from the other results
+static void bench_empty(void) {
+}
+
+static void bench_poisson_delay(void) {
+  s_sink = generate_poisson_delay();
+}
+
+static void bench_encode_snprintf(void) {
+  s_slot.entropy++;
+  sample_arena_encode(&s_slot);
+  s_sink = s_slot.len;
+}
+
+// The same payload without printf: digits written backwards, then copied
+static void bench_encode_manual(void) {
+  static const char PREFIX[] = "{\"entropy\": ";
+  char digits[20];
+  int n = 0;
+  uint64_t v = ++s_slot.entropy;
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v != 0);
+
+  char *out = s_slot.payload;
+  memcpy(out, PREFIX, sizeof(PREFIX) - 1);
+  out += sizeof(PREFIX) - 1;
+  while (n > 0) {
+    *out++ = digits[--n];
+  }
+  *out++ = '}';
+  *out = '\0';
+  s_slot.len = out - s_slot.payload;
+  s_sink = s_slot.len;
+}
+
+static void bench_esp_random(void) {
+  uint32_t *words = (uint32_t *)s_buf;
+  for (int i = 0; i < sizeof(s_buf) / sizeof(uint32_t); i++) {
+    words[i] = esp_random();
+  }
+}
+
+static void bench_esp_fill_random(void) {
+  esp_fill_random(s_buf, sizeof(s_buf));
+}
+
+static void bench_health_sample(void) {
+  s_sink = entropy_health_feed(s_buf, sizeof(uint64_t));
+}
+
+static void bench_health_1k(void) {
+  s_sink = entropy_health_feed(s_buf, sizeof(s_buf));
+}
+
+static void bench_sha256_sample(void) {
+  mbedtls_sha256(s_buf, sizeof(uint64_t), s_digest, 0);
+  s_sink = s_digest[0];
+}
+
+static void bench_sha256_1k(void) {
+  mbedtls_sha256(s_buf, sizeof(s_buf), s_digest, 0);
+  s_sink = s_digest[0];
+}
+
+// What the local server does per request: health tests and conditioning
+// included
+static void bench_sampler_fill_1k(void) {
+  s_sink = sampler_fill(s_buf, sizeof(s_buf));
+}
+
+// Bulk mode: the sampler pipeline runs flat out into an SPSC ring and a
+// consumer task drains it, as the connectivity task would. Each side
+// blocks on a task notification from the other when it cannot go on, so
+// neither spins and starves the idle task when both share a core.
+static spsc_ring_t s_pipe;
+static _Atomic int s_in_flight;
+static TaskHandle_t s_bench_task;
+static TaskHandle_t s_producer_task;
+static TaskHandle_t s_consumer_task;
+
+static void pipeline_producer(void *arg) {
+  for (int done = 0; done < PIPELINE_SAMPLES; ) {
+    // Never ask for more slots than the arena has
+    if (atomic_load(&s_in_flight) >= CONFIG_SAMPLE_ARENA_SLOTS) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    sample_slot_t *slot = sampler_produce();
+    if (slot != NULL) {
+      atomic_fetch_add(&s_in_flight, 1);
+      spsc_ring_push(&s_pipe, slot);
+      xTaskNotifyGive(s_consumer_task);
+      done++;
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+static void pipeline_consumer(void *arg) {
+  for (int done = 0; done < PIPELINE_SAMPLES; ) {
+    sample_slot_t *slot = spsc_ring_pop(&s_pipe);
+    if (slot == NULL) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    s_sink = slot->len;
+    sample_arena_release(slot);
+    atomic_fetch_sub(&s_in_flight, 1);
+    xTaskNotifyGive(s_producer_task);
+    done++;
+  }
+  xTaskNotifyGive(s_bench_task);
+  vTaskDelete(NULL);
+}
+
+static void bench_pipeline(const char *name, BaseType_t producer_core, BaseType_t consumer_core) {
+  s_bench_task = xTaskGetCurrentTaskHandle();
+  int64_t start = esp_timer_get_time();
+  // The consumer only notifies the producer after taking one of its
+  // samples, so the producer's handle is set by then
+  xTaskCreatePinnedToCore(pipeline_consumer, "bench_cons", 4096, NULL, 5, &s_consumer_task, consumer_core);
+  xTaskCreatePinnedToCore(pipeline_producer, "bench_prod", 4096, NULL, 5, &s_producer_task, producer_core);
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  int64_t elapsed_us = esp_timer_get_time() - start;
+
+  printf("BENCH {\"name\":\"%s\",\"unit\":\"samples_per_s\",\"n\":%d,\"rate\":%lu}\n", name,
+         PIPELINE_SAMPLES, (unsigned long)(PIPELINE_SAMPLES * 1000000LL / elapsed_us));
+}
+
+void bench_run(void) {
+  esp_fill_random(s_buf, sizeof(s_buf));
+  s_slot.entropy = ((uint64_t)esp_random() << 32) | esp_random();
+
+  bench("empty", bench_empty, 0);
+  bench("poisson_delay", bench_poisson_delay, 0);
+  bench("encode_snprintf", bench_encode_snprintf, 0);
+  bench("encode_manual", bench_encode_manual, 0);
+  bench("esp_random_1k", bench_esp_random, sizeof(s_buf));
+  bench("esp_fill_random_1k", bench_esp_fill_random, sizeof(s_buf));
+  bench("health_sample", bench_health_sample, sizeof(uint64_t));
+  bench("health_1k", bench_health_1k, sizeof(s_buf));
+  bench("sha256_sample", bench_sha256_sample, sizeof(uint64_t));
+  bench("sha256_1k", bench_sha256_1k, sizeof(s_buf));
+  bench("sampler_fill_1k", bench_sampler_fill_1k, sizeof(s_buf));
+  #if !defined(CONFIG_FREERTOS_UNICORE) && !defined(CONFIG_IDF_TARGET_LINUX)
+    bench_pipeline("pipeline_pinned", 1, 0);
+    bench_pipeline("pipeline_same_core", 0, 0);
+  #endif
+  bench_pipeline("pipeline_unpinned", tskNO_AFFINITY, tskNO_AFFINITY);
+  printf("BENCH DONE\n");
+}
+
+#endif
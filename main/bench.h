@@ -0,0 +1,25 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+// Microbenchmarks of the publish-cycle hot paths (CONFIG_BENCH_MODE). Each
+// result is printed as one "BENCH {json}" line; times are CPU cycles on the
+// chip and in QEMU, nanoseconds on the linux target.
+
+#ifdef CONFIG_BENCH_MODE
+void bench_run(void);
+#endif
@@ -0,0 +1,53 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "esp_log.h"
+
+#include "boot_time.h"
+
+#ifdef CONFIG_BOOT_TIME_REPORT
+
+static uint32_t s_at_ms[BOOT_STEP_COUNT];
+static bool s_reached[BOOT_STEP_COUNT];
+
+static const char *TAG = "FOSSOR";
+
+void boot_time_mark(boot_step_t step) {
+  if (s_reached[step]) {
+    return;
+  }
+  s_reached[step] = true;
+  s_at_ms[step] = esp_log_timestamp();
+  if (step != BOOT_PUBACK) {
+    return;
+  }
+
+  // Each span runs from the previous milestone, so they add up to the total
+  uint32_t span[BOOT_STEP_COUNT];
+  uint32_t prev = 0;
+  for (int i = 0; i < BOOT_STEP_COUNT; i++) {
+    span[i] = s_at_ms[i] > prev ? s_at_ms[i] - prev : 0;
+    prev = s_at_ms[i] > prev ? s_at_ms[i] : prev;
+  }
+  ESP_LOGI(TAG, "BOOT TIME [startup=%" PRIu32 " nvs=%" PRIu32 " link=%" PRIu32 " sample=%" PRIu32
+           " connect=%" PRIu32 " publish=%" PRIu32 " total=%" PRIu32 " ms]",
+           span[BOOT_APP_MAIN], span[BOOT_NVS_READY], span[BOOT_GOT_IP], span[BOOT_SESSION_START],
+           span[BOOT_CONNACK], span[BOOT_PUBACK], s_at_ms[BOOT_PUBACK]);
+}
+
+#endif
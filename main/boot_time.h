@@ -0,0 +1,41 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+// Milestones from reset to the first acknowledged publish, in
+// esp_log_timestamp() milliseconds. Only the first time each is reached
+// counts.
+typedef enum {
+  BOOT_APP_MAIN,          // ROM, bootloader and app start-up done
+  BOOT_NVS_READY,
+  BOOT_GOT_IP,
+  BOOT_SESSION_START,     // First sample ready with the link up
+  BOOT_CONNACK,
+  BOOT_PUBACK,
+  BOOT_STEP_COUNT
+} boot_step_t;
+
+#ifdef CONFIG_BOOT_TIME_REPORT
+
+// Record a milestone. Reaching BOOT_PUBACK logs the breakdown.
+void boot_time_mark(boot_step_t step);
+
+#else
+
+static inline void boot_time_mark(boot_step_t step) {}
+
+#endif
@@ -0,0 +1,306 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#else
+#include "lwip/sockets.h"
+#endif
+
+#include "broker_store.h"
+#include "device_certs.h"
+#include "dns_cache.h"
+
+#define BROKER_STORE_NAMESPACE  "brokers"
+#define BROKER_STORE_KEY        "uris"
+
+// A failed session costs as much as this much extra connect latency, then
+// halves every CONFIG_BROKER_PENALTY_HALF_LIFE_S
+#define BROKER_FAILURE_PENALTY_MS   10000
+// Round trips in TCP, TLS and MQTT CONNECT, to scale a TCP connect time
+#define BROKER_PROBE_RTT_FACTOR     4
+#define BROKER_PROBE_TIMEOUT_MS     2000
+
+static broker_entry_t s_brokers[BROKER_STORE_MAX_ENTRIES];
+static int s_broker_count;
+static uint32_t s_cycles;
+
+static const char *TAG = "FOSSOR";
+
+static void broker_store_add(const char *uri, size_t len, uint32_t port) {
+  if (len == 0) {
+    return;
+  } else if (len >= BROKER_URI_MAX || s_broker_count == BROKER_STORE_MAX_ENTRIES) {
+    ESP_LOGW(TAG, "BROKER SKIPPED [%.*s]", (int)len, uri);
+    return;
+  }
+  broker_entry_t *b = &s_brokers[s_broker_count++];
+  memset(b, 0, sizeof(*b));
+  memcpy(b->uri, uri, len);
+  b->port = port;
+}
+
+// Comma-separated URIs, blanks ignored
+static void broker_store_add_list(const char *list) {
+  while (*list != '\0') {
+    list += strspn(list, " ,");
+    size_t len = strcspn(list, " ,");
+    broker_store_add(list, len, 0);
+    list += len;
+  }
+}
+
+void broker_store_load(void) {
+  s_broker_count = 0;
+  #ifdef CONFIG_TRANSPORT_COAP
+    broker_store_add(CONFIG_COAP_SERVER_URI, strlen(CONFIG_COAP_SERVER_URI), 0);
+  #else
+    // The issued broker takes its port from the configuration, not the URI
+    broker_store_add(const_mqtt_broker_uri, strlen(const_mqtt_broker_uri), CONFIG_BROKER_PORT);
+  #endif
+
+  // Static, as it is only needed once at start-up
+  static char list[BROKER_STORE_MAX_ENTRIES * BROKER_URI_MAX];
+  size_t len = sizeof(list);
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open(BROKER_STORE_NAMESPACE, NVS_READONLY, &nvs);
+  if (err == ESP_OK) {
+    err = nvs_get_str(nvs, BROKER_STORE_KEY, list, &len);
+    nvs_close(nvs);
+  }
+  broker_store_add_list(err == ESP_OK ? list : CONFIG_BROKER_FALLBACK_URIS);
+  ESP_LOGI(TAG, "BROKERS LOADED [%d%s]", s_broker_count, err == ESP_OK ? ", from NVS" : "");
+}
+
+int broker_store_count(void) {
+  return s_broker_count;
+}
+
+const broker_entry_t *broker_store_get(int index) {
+  if (index < 0 || index >= s_broker_count) {
+    return NULL;
+  }
+  return &s_brokers[index];
+}
+
+static float broker_penalty(const broker_entry_t *b, int64_t now_us) {
+  float half_lives = (now_us - b->penalty_us) / (CONFIG_BROKER_PENALTY_HALF_LIFE_S * 1e6f);
+  return b->penalty_ms * exp2f(-half_lives);
+}
+
+int broker_store_select(void) {
+  int64_t now_us = esp_timer_get_time();
+  int best = 0;
+  float best_cost = 0;
+  for (int i = 0; i < s_broker_count; i++) {
+    // Endpoints without a measurement yet cost nothing, so they get one
+    float cost = s_brokers[i].latency_ms + broker_penalty(&s_brokers[i], now_us);
+    if (i == 0 || cost < best_cost) {
+      best = i;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+static void broker_store_update_latency(broker_entry_t *b, uint32_t latency_ms) {
+  b->latency_ms = b->latency_ms == 0 ? latency_ms : (b->latency_ms * 3 + latency_ms) / 4;
+}
+
+void broker_store_record_result(int index, bool success, uint32_t connect_ms) {
+  if (index < 0 || index >= s_broker_count) {
+    return;
+  }
+  broker_entry_t *b = &s_brokers[index];
+  int64_t now_us = esp_timer_get_time();
+  b->penalty_ms = broker_penalty(b, now_us);
+  b->penalty_us = now_us;
+  if (success) {
+    broker_store_update_latency(b, connect_ms);
+    // A broker that works again wins its traffic back quickly
+    b->penalty_ms /= 2;
+    if (b->successes < UINT16_MAX) {
+      b->successes++;
+    }
+  } else {
+    b->penalty_ms += BROKER_FAILURE_PENALTY_MS;
+    if (b->failures < UINT16_MAX) {
+      b->failures++;
+    }
+    ESP_LOGW(TAG, "BROKER FAILED [%s, penalty=%.0f ms]", b->uri, b->penalty_ms);
+  }
+}
+
+bool broker_uri_address(const char *uri, uint32_t port, char *host, size_t host_size, uint16_t *port_out) {
+  const char *start = strstr(uri, "://");
+  bool tls = start == NULL || strncmp(uri, "mqtts", 5) == 0 || strncmp(uri, "ssl", 3) == 0;
+  start = start ? start + 3 : uri;
+  size_t len = strcspn(start, ":/");
+  if (len == 0 || len >= host_size) {
+    return false;
+  }
+  memcpy(host, start, len);
+  host[len] = '\0';
+  if (port != 0) {
+    *port_out = port;
+  } else if (start[len] == ':') {
+    *port_out = atoi(start + len + 1);
+  } else if (strncmp(uri, "coaps", 5) == 0) {
+    *port_out = 5684;
+  } else {
+    *port_out = tls ? 8883 : 1883;
+  }
+  return true;
+}
+
+#ifndef CONFIG_TRANSPORT_COAP
+
+// Address of the endpoint, resolved through the DNS cache. False if it has
+// none.
+static bool broker_probe_resolve(const broker_entry_t *b, struct sockaddr_in *addr) {
+  char host[BROKER_URI_MAX];
+  uint16_t port;
+  if (!broker_uri_address(b->uri, b->port, host, sizeof(host), &port)) {
+    return false;
+  }
+  *addr = (struct sockaddr_in){ .sin_family = AF_INET, .sin_port = htons(port) };
+  return inet_pton(AF_INET, host, &addr->sin_addr) == 1 || dns_cache_lookup(host, &addr->sin_addr);
+}
+
+// Start a non-blocking TCP connect. Returns the socket, or -1 if the
+// connect failed at once.
+static int broker_probe_connect(const struct sockaddr_in *addr) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) {
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0 && errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// TCP connect time to every endpoint in milliseconds, 0 on failure. The
+// connects run side by side, so the whole probe takes at most
+// BROKER_PROBE_TIMEOUT_MS.
+static void broker_probe_all(uint32_t *rtt_ms) {
+  // Resolve every address first, so no broker's time includes a DNS
+  // lookup or another broker's set-up
+  struct sockaddr_in addrs[BROKER_STORE_MAX_ENTRIES];
+  bool resolved[BROKER_STORE_MAX_ENTRIES];
+  for (int i = 0; i < s_broker_count; i++) {
+    resolved[i] = broker_probe_resolve(&s_brokers[i], &addrs[i]);
+  }
+
+  int fds[BROKER_STORE_MAX_ENTRIES];
+  int64_t start_us[BROKER_STORE_MAX_ENTRIES];
+  int pending = 0;
+  for (int i = 0; i < s_broker_count; i++) {
+    rtt_ms[i] = 0;
+    fds[i] = resolved[i] ? broker_probe_connect(&addrs[i]) : -1;
+    start_us[i] = esp_timer_get_time();
+    pending += fds[i] >= 0;
+  }
+
+  int64_t deadline_us = start_us[0] + BROKER_PROBE_TIMEOUT_MS * 1000LL;
+  while (pending > 0) {
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    if (remaining_us <= 0) {
+      break;
+    }
+    fd_set writable;
+    FD_ZERO(&writable);
+    int max_fd = -1;
+    for (int i = 0; i < s_broker_count; i++) {
+      if (fds[i] >= 0) {
+        FD_SET(fds[i], &writable);
+        max_fd = fds[i] > max_fd ? fds[i] : max_fd;
+      }
+    }
+    struct timeval timeout = { .tv_sec = remaining_us / 1000000, .tv_usec = remaining_us % 1000000 };
+    if (select(max_fd + 1, NULL, &writable, NULL, &timeout) <= 0) {
+      break;
+    }
+    int64_t now_us = esp_timer_get_time();
+    for (int i = 0; i < s_broker_count; i++) {
+      if (fds[i] >= 0 && FD_ISSET(fds[i], &writable)) {
+        int so_error = -1;
+        socklen_t so_len = sizeof(so_error);
+        if (getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &so_error, &so_len) == 0 && so_error == 0) {
+          rtt_ms[i] = (now_us - start_us[i]) / 1000 + 1;
+        }
+        close(fds[i]);
+        fds[i] = -1;
+        pending--;
+      }
+    }
+  }
+
+  for (int i = 0; i < s_broker_count; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+    if (rtt_ms[i] == 0) {
+      char host[BROKER_URI_MAX];
+      uint16_t port;
+      if (broker_uri_address(s_brokers[i].uri, s_brokers[i].port, host, sizeof(host), &port)) {
+        dns_cache_forget(host);
+      }
+    }
+  }
+}
+
+#endif
+
+void broker_store_probe(void) {
+  // A TCP connect says nothing about a CoAP server; sessions alone rank
+  // those. With one endpoint there is nothing to choose.
+  #ifndef CONFIG_TRANSPORT_COAP
+    if (s_broker_count < 2) {
+      return;
+    }
+    uint32_t rtts[BROKER_STORE_MAX_ENTRIES];
+    broker_probe_all(rtts);
+    for (int i = 0; i < s_broker_count; i++) {
+      uint32_t rtt_ms = rtts[i];
+      if (rtt_ms == 0) {
+        broker_store_record_result(i, false, 0);
+      } else {
+        broker_store_update_latency(&s_brokers[i], rtt_ms * BROKER_PROBE_RTT_FACTOR);
+      }
+      ESP_LOGI(TAG, "BROKER PROBED [%s, tcp=%" PRIu32 " ms, score=%" PRIu32 " ms]", s_brokers[i].uri, rtt_ms,
+               s_brokers[i].latency_ms + (uint32_t)broker_penalty(&s_brokers[i], esp_timer_get_time()));
+    }
+  #endif
+}
+
+bool broker_store_cycle_done(void) {
+  return CONFIG_BROKER_PROBE_INTERVAL > 0 && ++s_cycles % CONFIG_BROKER_PROBE_INTERVAL == 0;
+}
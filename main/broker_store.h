@@ -0,0 +1,63 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BROKER_STORE_MAX_ENTRIES    4
+#define BROKER_URI_MAX              128
+
+// One broker endpoint plus its health
+typedef struct {
+  char uri[BROKER_URI_MAX];
+  uint32_t port;                        // 0: from the URI or its scheme
+  uint16_t successes;
+  uint16_t failures;
+  uint32_t latency_ms;                  // Smoothed connect latency, 0 if unknown
+  float penalty_ms;                     // Failure penalty, decays over time
+  int64_t penalty_us;                   // When the penalty was last updated
+} broker_entry_t;
+
+// Build the endpoint list: the broker issued with the certificates first,
+// then the "uris" string of the "brokers" NVS namespace if there is one,
+// else CONFIG_BROKER_FALLBACK_URIS. Must run after nvs_flash_init().
+void broker_store_load(void);
+
+int broker_store_count(void);
+const broker_entry_t *broker_store_get(int index);
+
+// Index of the endpoint with the lowest expected connect latency
+int broker_store_select(void);
+
+// Record the outcome of a session. connect_ms is the time from starting
+// the client to CONNACK.
+void broker_store_record_result(int index, bool success, uint32_t connect_ms);
+
+// Time a TCP connect to every endpoint and fold it into their latency.
+// The connects run side by side; blocks for up to BROKER_PROBE_TIMEOUT_MS
+// in total, so call it while nothing is waiting to be published.
+void broker_store_probe(void);
+
+// Host and port of a URI such as mqtts://host:8883/path. A port other
+// than 0 overrides the URI's. Without one, mqtts:// and ssl:// use 8883,
+// coaps:// 5684 and mqtt:// or tcp:// 1883.
+bool broker_uri_address(const char *uri, uint32_t port, char *host, size_t host_size, uint16_t *port_out);
+
+// Count a publish cycle. True every CONFIG_BROKER_PROBE_INTERVAL cycles,
+// when a probe is due.
+bool broker_store_cycle_done(void);
@@ -0,0 +1,67 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "conn_sm.h"
+
+static const char *const STATE_NAMES[CONN_STATE_COUNT] = {
+  "OFFLINE", "ASSOCIATING", "IP", "MQTT_READY", "DRAINING",
+};
+
+conn_state_t conn_sm_next(conn_state_t state, conn_event_id_t event) {
+  // Losing the link ends whatever was going on above it
+  if (event == CONN_EV_DISCONNECTED && state != CONN_OFFLINE) {
+    return CONN_ASSOCIATING;
+  }
+
+  switch (state) {
+    case CONN_OFFLINE:
+      if (event == CONN_EV_SCAN_DONE || event == CONN_EV_PROVISIONED) {
+        return CONN_ASSOCIATING;
+      } else if (event == CONN_EV_GOT_IP) {
+        return CONN_IP;
+      }
+      break;
+    case CONN_ASSOCIATING:
+      if (event == CONN_EV_GOT_IP) {
+        return CONN_IP;
+      }
+      break;
+    case CONN_IP:
+      if (event == CONN_EV_MQTT_CONNECTED) {
+        return CONN_MQTT_READY;
+      } else if (event == CONN_EV_MQTT_DISCONNECTED || event == CONN_EV_MQTT_ERROR) {
+        return CONN_DRAINING;
+      }
+      break;
+    case CONN_MQTT_READY:
+      if (event == CONN_EV_MQTT_PUBLISHED || event == CONN_EV_MQTT_DISCONNECTED || event == CONN_EV_MQTT_ERROR) {
+        return CONN_DRAINING;
+      }
+      break;
+    case CONN_DRAINING:
+      if (event == CONN_EV_DRAINED) {
+        return CONN_IP;
+      }
+      break;
+    default:
+      break;
+  }
+  return state;
+}
+
+const char *conn_state_name(conn_state_t state) {
+  return state < CONN_STATE_COUNT ? STATE_NAMES[state] : "?";
+}
@@ -0,0 +1,58 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+// Connectivity state machine transitions. Kept free of ESP-IDF headers so
+// it builds and runs unchanged on a host.
+
+typedef enum {
+  CONN_OFFLINE,           // No credentials yet, or Wi-Fi not started
+  CONN_ASSOCIATING,       // Selecting and joining an AP
+  CONN_IP,                // Link up, no MQTT session (or one connecting)
+  CONN_MQTT_READY,        // Broker CONNACK received, publishing
+  CONN_DRAINING,          // Session done, client being torn down
+  CONN_STATE_COUNT
+} conn_state_t;
+
+typedef enum {
+  // Wi-Fi, IP and SmartConfig
+  CONN_EV_WIFI_START,
+  CONN_EV_SCAN_DONE,
+  CONN_EV_ASSOCIATED,
+  CONN_EV_DISCONNECTED,
+  CONN_EV_GOT_IP,
+  CONN_EV_RSSI_LOW,
+  CONN_EV_PROVISIONED,    // SmartConfig delivered credentials
+  CONN_EV_SC_DONE,
+  CONN_EV_LINK_RETRY,     // Back-off after every AP failed has passed
+  // Sample schedule
+  CONN_EV_SAMPLE_DUE,
+  CONN_EV_SAMPLE_READY,   // arg: 1 if the sampler produced a sample
+  // MQTT session
+  CONN_EV_MQTT_CONNECTED,
+  CONN_EV_MQTT_PUBLISHED,
+  CONN_EV_MQTT_DISCONNECTED,
+  CONN_EV_MQTT_ERROR,
+  CONN_EV_DRAINED,
+  // Firmware update
+  CONN_EV_OTA_DONE,       // Check finished without restarting
+  CONN_EV_COUNT
+} conn_event_id_t;
+
+conn_state_t conn_sm_next(conn_state_t state, conn_event_id_t event);
+
+const char *conn_state_name(conn_state_t state);
@@ -0,0 +1,459 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#include "boot_time.h"
+#include "broker_store.h"
+#include "connectivity.h"
+#include "dlog.h"
+#include "dns_cache.h"
+#include "local_server.h"
+#include "net_link.h"
+#include "ota.h"
+#include "phase_trace.h"
+#include "rate_ctl.h"
+#include "sample_arena.h"
+#include "sampler.h"
+#include "soak.h"
+#include "task_table.h"
+#include "telemetry.h"
+#include "transport.h"
+
+#define MQTT_TOPIC              CONFIG_MQTT_TOPIC
+#define MQTT_BATCH_TOPIC        CONFIG_MQTT_TOPIC "/batch"
+#define TELEMETRY_TOPIC         CONFIG_MQTT_TOPIC "/telemetry"
+#define AVERAGE_DELAY_MINUTES   CONFIG_AVERAGE_DELAY_MINUTES
+
+#define CONN_QUEUE_LENGTH       16
+
+#ifdef CONFIG_ADAPTIVE_BATCHING
+static char s_batch_payload[RATE_CTL_BATCH_MAX * SAMPLE_BATCH_ENTRY_MAX + 2];
+#endif
+
+// A sample, and a full batch, must each fit one outbox item
+#ifdef CONFIG_STATIC_OUTBOX
+_Static_assert(TRANSPORT_PUBLISH_OVERHEAD + sizeof(MQTT_TOPIC) - 1 + SAMPLE_PAYLOAD_MAX <= CONFIG_STATIC_OUTBOX_ITEM_SIZE,
+               "STATIC_OUTBOX_ITEM_SIZE cannot hold a sample");
+#ifdef CONFIG_ADAPTIVE_BATCHING
+_Static_assert(TRANSPORT_PUBLISH_OVERHEAD + sizeof(MQTT_BATCH_TOPIC) - 1 + sizeof(s_batch_payload) <=
+               CONFIG_STATIC_OUTBOX_ITEM_SIZE, "STATIC_OUTBOX_ITEM_SIZE cannot hold a full batch; raise it or lower BATCH_MAX");
+#endif
+#endif
+
+static QueueHandle_t s_queue;
+static StaticQueue_t s_queue_buffer;
+static uint8_t s_queue_storage[CONN_QUEUE_LENGTH * sizeof(conn_event_t)];
+static conn_state_t s_state = CONN_OFFLINE;
+
+static bool s_in_session;               // A transport session is open
+static uint32_t s_session;              // Tags session events with their session
+static int s_msg_id;
+static sample_slot_t *s_batch[RATE_CTL_BATCH_MAX]; // Pending samples, oldest first
+static int s_batch_len;
+static int s_batch_sent;                // Samples in the unacknowledged publish
+static int64_t s_flush_us;              // 0 unless a batch is being held
+static bool s_sample_requested;         // Sampler is producing one
+static bool s_published;                // Outcome of the last session
+static int64_t s_next_sample_us;        // 0 while no sample is scheduled
+static int s_broker = -1;               // Broker store index, -1 for a test broker
+static int64_t s_session_start_us;
+static int s_failed_in_row;             // Sessions lost since the last CONNACK
+static bool s_probe_due;                // Probe the brokers at the next idle moment
+static char s_uri[BROKER_URI_MAX];      // Broker URI with the host resolved
+static char s_host[BROKER_URI_MAX];     // Broker host name, empty if none
+
+static const char *TAG = "FOSSOR";
+
+void connectivity_post(conn_event_id_t id, int32_t arg) {
+  conn_event_t event = { .id = id, .arg = arg };
+  if (xQueueSend(s_queue, &event, 0) != pdTRUE) {
+    ESP_LOGE(TAG, "CONNECTIVITY QUEUE FULL [event=%d]", id);
+  }
+}
+
+// Fixed broker of a test setup, NULL to use the broker store
+static const char *test_broker_uri(void) {
+  #ifdef CONFIG_IDF_TARGET_LINUX
+    return CONFIG_SIM_BROKER_URI;
+  #endif
+  #ifdef CONFIG_SOAK_TEST
+    // Soak runs go to a local broker
+    if (CONFIG_SOAK_BROKER_URI[0] != '\0') {
+      return CONFIG_SOAK_BROKER_URI;
+    }
+  #endif
+  return NULL;
+}
+
+// Broker for the next session. Test brokers give their port in the URI.
+static const char *broker_uri(uint32_t *port) {
+  const char *uri = test_broker_uri();
+  if (uri != NULL) {
+    s_broker = -1;
+    *port = 0;
+    return uri;
+  }
+  s_broker = broker_store_select();
+  const broker_entry_t *broker = broker_store_get(s_broker);
+  *port = broker->port;
+  return broker->uri;
+}
+
+static void schedule_next_sample(void);
+
+#ifdef CONFIG_SOAK_TEST
+// A soak run counts a failed cycle and moves on without its samples
+static void drop_batch(void) {
+  for (int i = 0; i < s_batch_len; i++) {
+    sample_arena_release(s_batch[i]);
+  }
+  s_batch_len = 0;
+  s_batch_sent = 0;
+}
+#endif
+
+// Release the acknowledged samples; the rest move up
+static void release_sent(void) {
+  for (int i = 0; i < s_batch_sent; i++) {
+    sample_arena_release(s_batch[i]);
+  }
+  s_batch_len -= s_batch_sent;
+  memmove(s_batch, s_batch + s_batch_sent, s_batch_len * sizeof(s_batch[0]));
+  s_batch_sent = 0;
+}
+
+// Open a session for the pending batch. On failure the batch stays pending,
+// except in a soak run.
+static void session_start(void) {
+  // Resolve the broker here, from the DNS cache if possible, so DNS is a
+  // phase of its own and the client connects to the address
+  uint32_t port;
+  const char *uri = dns_cache_resolve_uri(broker_uri(&port), s_uri, sizeof(s_uri), s_host, sizeof(s_host));
+  phase_trace_mark(PHASE_DNS);
+  app_task_session_begin();
+  boot_time_mark(BOOT_SESSION_START);
+  s_session_start_us = esp_timer_get_time();
+
+  s_in_session = transport_session_start(uri, port, s_host, ++s_session);
+  if (!s_in_session) {
+    app_task_session_end();
+    telemetry_count(TELEM_PUBLISH_FAILED);
+    #ifdef CONFIG_SOAK_TEST
+      drop_batch();
+    #endif
+    schedule_next_sample();
+  }
+}
+
+static void session_stop(void) {
+  if (s_in_session) {
+    transport_session_stop();
+    s_in_session = false;
+    app_task_session_end();
+  }
+}
+
+// Generate exp distributed delay
+uint32_t generate_poisson_delay(void) {
+  float U = (float)esp_random() / UINT32_MAX;
+  float delay_minutes = -AVERAGE_DELAY_MINUTES * log(U);
+  return (uint32_t)(delay_minutes * 60 * 1000 / portTICK_PERIOD_MS);
+}
+
+static void schedule_next_sample(void) {
+  #ifdef CONFIG_SOAK_TEST
+    s_next_sample_us = esp_timer_get_time() + CONFIG_SOAK_CYCLE_DELAY_MS * 1000LL;
+  #else
+    s_next_sample_us = esp_timer_get_time() + (int64_t)generate_poisson_delay() * portTICK_PERIOD_MS * 1000;
+  #endif
+}
+
+// Telemetry rides on the sample's session. Both transports send QoS 0
+// before a later session stop, so the session can be torn down next.
+static void publish_telemetry(void) {
+  int len;
+  const char *record = telemetry_record(net_link_rssi(), &len);
+  if (record != NULL && transport_publish(TELEMETRY_TOPIC, record, len, 0, -1) < 0) {
+    ESP_LOGE(TAG, "TELEMETRY NOT SENT");
+  }
+}
+
+// Start a session for the waiting samples, if the link allows and the
+// batch is due. Samples wait in the arena while an update is downloading.
+static void publish_next(void) {
+  if (s_state != CONN_IP || s_in_session || ota_busy()) {
+    return;
+  }
+  sample_slot_t *slot;
+  while (s_batch_len < RATE_CTL_BATCH_MAX && (slot = sampler_take()) != NULL) {
+    s_batch[s_batch_len++] = slot;
+  }
+  if (s_batch_len == 0) {
+    return;
+  }
+  s_flush_us = rate_ctl_flush_time(s_batch_len, s_batch[0]->timestamp_us, sample_arena_in_use());
+  if (s_flush_us == 0) {
+    session_start();
+  }
+}
+
+// Publish the oldest count pending samples. A single sample goes out as it
+// always has.
+static int publish_samples(int count) {
+  if (count == 1) {
+    return transport_publish(MQTT_TOPIC, s_batch[0]->payload, s_batch[0]->len, 1, s_batch[0]->seq);
+  }
+  #ifdef CONFIG_ADAPTIVE_BATCHING
+    int len = sample_arena_encode_batch(s_batch, count, esp_timer_get_time(),
+                                        s_batch_payload, sizeof(s_batch_payload));
+    if (len > 0) {
+      return transport_publish(MQTT_BATCH_TOPIC, s_batch_payload, len, 1, s_batch[0]->seq);
+    }
+  #endif
+  return -1;
+}
+
+// Publish the pending batch. One the client cannot take, because the
+// broker or the outbox has no room for it, is halved until it fits; the
+// rest follows on the same session once it is acknowledged.
+static int publish_batch(void) {
+  for (int count = s_batch_len; count > 0; count /= 2) {
+    int msg_id = publish_samples(count);
+    if (msg_id >= 0) {
+      s_batch_sent = count;
+      return msg_id;
+    }
+  }
+  return -1;
+}
+
+static void connectivity_dispatch(const conn_event_t *event);
+
+// Tear the session down and return to CONN_IP
+static void drain(void) {
+  session_stop();
+  connectivity_dispatch(&(conn_event_t){ .id = CONN_EV_DRAINED });
+}
+
+static void connectivity_dispatch(const conn_event_t *event) {
+  // Events from a session that has since been closed
+  bool mqtt_event = event->id >= CONN_EV_MQTT_CONNECTED && event->id <= CONN_EV_MQTT_ERROR;
+  if (mqtt_event && (!s_in_session || (uint32_t)event->arg != s_session)) {
+    return;
+  }
+
+  conn_state_t prev = s_state;
+  s_state = conn_sm_next(s_state, event->id);
+  if (s_state != prev) {
+    APP_LOG(DLOG_STATE, prev, s_state);
+  }
+
+  net_link_handle(event);
+
+  switch (event->id) {
+    case CONN_EV_GOT_IP:
+      boot_time_mark(BOOT_GOT_IP);
+      if (s_next_sample_us == 0 && s_batch_len == 0 && !s_sample_requested) {
+        APP_LOG(DLOG_GENERATING_FIRST);
+        schedule_next_sample();
+      }
+      // Probed once nothing is waiting, so the first sample is not held up
+      s_probe_due = test_broker_uri() == NULL;
+      local_server_start();
+      publish_next();
+      break;
+    case CONN_EV_DISCONNECTED:
+      telemetry_count(TELEM_RECONNECT_LINK);
+      // The pending sample, if any, goes out after the link is back
+      session_stop();
+      break;
+    case CONN_EV_SAMPLE_DUE:
+      s_next_sample_us = 0;
+      phase_trace_mark(PHASE_WAKE);
+      s_sample_requested = true;
+      sampler_request();
+      #ifndef CONFIG_SOAK_TEST
+        // Generation keeps its own pace, however long publishing takes
+        schedule_next_sample();
+      #endif
+      break;
+    case CONN_EV_SAMPLE_READY:
+      s_sample_requested = false;
+      #ifdef CONFIG_SOAK_TEST
+        if (!event->arg) {
+          schedule_next_sample();
+        }
+      #endif
+      publish_next();
+      break;
+    case CONN_EV_MQTT_CONNECTED:
+      boot_time_mark(BOOT_CONNACK);
+      broker_store_record_result(s_broker, true, (esp_timer_get_time() - s_session_start_us) / 1000);
+      s_failed_in_row = 0;
+      APP_LOG(DLOG_SENDING);
+      s_msg_id = publish_batch();
+      if (s_msg_id < 0) {
+        // Not even one sample could be queued. Keep them for the next
+        // session, without blaming the broker.
+        ESP_LOGE(TAG, "ENTROPY NOT SENT [pending=%d]", s_batch_len);
+        s_failed_in_row++;
+        s_published = false;
+        telemetry_count(TELEM_PUBLISH_FAILED);
+        drain();
+      } else {
+        phase_trace_mark(PHASE_PUBLISH);
+      }
+      break;
+    case CONN_EV_MQTT_PUBLISHED:
+      for (int i = 0; i < s_batch_sent; i++) {
+        APP_LOG(DLOG_RECEIVED, s_msg_id, s_batch[i]->seq);
+        APP_LOG(DLOG_ENTROPY, (uint32_t)(s_batch[i]->entropy >> 32), (uint32_t)s_batch[i]->entropy);
+      }
+      release_sent();
+      // The rest of a batch that had to be split
+      if (s_batch_len > 0 && (s_msg_id = publish_batch()) >= 0) {
+        break;
+      }
+      rate_ctl_record(true, (esp_timer_get_time() - s_session_start_us) / 1000, net_link_rssi());
+      s_published = true;
+      telemetry_count(TELEM_PUBLISH_OK);
+      ota_confirm();
+      boot_time_mark(BOOT_PUBACK);
+      publish_telemetry();
+      app_task_report_stacks();
+      drain();
+      break;
+    case CONN_EV_MQTT_DISCONNECTED:
+      APP_LOG(DLOG_MQTT_DISCONNECTED);
+      broker_store_record_result(s_broker, false, 0);
+      rate_ctl_record(false, 0, net_link_rssi());
+      s_failed_in_row++;
+      #ifdef CONFIG_SOAK_TEST
+        // Count the cycle as failed and move on
+        drop_batch();
+      #endif
+      // Otherwise samples not yet acknowledged stay pending for the next
+      // session; only release_sent() frees them
+      s_published = false;
+      telemetry_count(TELEM_PUBLISH_FAILED);
+      telemetry_count(TELEM_RECONNECT_SESSION);
+      drain();
+      break;
+    case CONN_EV_MQTT_ERROR:
+      ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+      broker_store_record_result(s_broker, false, 0);
+      rate_ctl_record(false, 0, net_link_rssi());
+      // The address may have moved; look it up again next time
+      if (s_host[0] != '\0') {
+        dns_cache_forget(s_host);
+      }
+      if (++s_failed_in_row == broker_store_count()) {
+        ESP_LOGE(TAG, "ALL BROKERS FAILED [%d in a row]", s_failed_in_row);
+      }
+      #ifdef CONFIG_SOAK_TEST
+        // Count the cycle as failed and move on
+        drop_batch();
+      #endif
+      // Otherwise the samples stay pending for the next broker
+      s_published = false;
+      telemetry_count(TELEM_PUBLISH_FAILED);
+      telemetry_count(TELEM_RECONNECT_SESSION);
+      drain();
+      break;
+    case CONN_EV_DRAINED:
+      phase_trace_cycle_done();
+      if (!soak_cycle_done(s_published)) {
+        break;
+      }
+      APP_LOG(DLOG_GENERATING_MORE);
+      #ifdef CONFIG_SOAK_TEST
+        schedule_next_sample();
+      #endif
+      ota_cycle_done();
+      if (test_broker_uri() == NULL && broker_store_cycle_done()) {
+        s_probe_due = true;
+      }
+      // Samples generated while this one was out go next, and a failed
+      // one goes to the next broker. Once every broker has failed in a
+      // row, wait for the next sample instead.
+      if (s_failed_in_row < broker_store_count()) {
+        publish_next();
+      }
+      break;
+    case CONN_EV_OTA_DONE:
+      publish_next();
+      break;
+    default:
+      break;
+  }
+}
+
+// Connectivity task: one queue for every event, the sample schedule as timeout
+void connectivity_task(void *pvParameters) {
+  conn_event_t event;
+  // Runs while the link comes up
+  transport_prepare();
+  #ifdef CONFIG_FAST_START_PUBLISH_NOW
+    // The first sample right away instead of after a Poisson delay
+    s_next_sample_us = esp_timer_get_time();
+  #endif
+  while (1) {
+    // Probe between sessions, when no sample is waiting to go out
+    if (s_probe_due && s_state == CONN_IP && !s_in_session && s_batch_len == 0 && !ota_busy()) {
+      s_probe_due = false;
+      broker_store_probe();
+    }
+
+    // Wake for the next sample or a held batch, whichever comes first
+    bool flush_first = s_flush_us != 0 && (s_next_sample_us == 0 || s_flush_us <= s_next_sample_us);
+    int64_t wake_us = flush_first ? s_flush_us : s_next_sample_us;
+    TickType_t wait = portMAX_DELAY;
+    if (wake_us != 0) {
+      int64_t remaining_us = wake_us - esp_timer_get_time();
+      wait = remaining_us > 0 ? (TickType_t)(remaining_us / 1000 / portTICK_PERIOD_MS) : 0;
+    }
+
+    // Print deferred logs while no session is in flight
+    if (!s_in_session) {
+      dlog_flush();
+    }
+
+    if (xQueueReceive(s_queue, &event, wait) == pdTRUE) {
+      connectivity_dispatch(&event);
+    } else if (flush_first) {
+      s_flush_us = 0;
+      publish_next();
+    } else if (s_next_sample_us != 0) {
+      connectivity_dispatch(&(conn_event_t){ .id = CONN_EV_SAMPLE_DUE });
+    }
+  }
+}
+
+void connectivity_start(void) {
+  s_queue = xQueueCreateStatic(CONN_QUEUE_LENGTH, sizeof(conn_event_t), s_queue_storage, &s_queue_buffer);
+  app_task_start(APP_TASK_CONNECTIVITY, NULL);
+  sampler_start();
+  ota_start();
+}
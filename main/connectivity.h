@@ -0,0 +1,38 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "conn_sm.h"
+
+typedef struct {
+  conn_event_id_t id;
+  int32_t arg;
+} conn_event_t;
+
+// Queue an event for the connectivity task. Safe from any task.
+void connectivity_post(conn_event_id_t id, int32_t arg);
+
+// Create the event queue, the connectivity and sampler tasks. The link is
+// brought up separately, with net_link_start().
+void connectivity_start(void);
+
+// Task body, listed in the task table
+void connectivity_task(void *pvParameters);
+
+// Exponentially distributed delay until the next sample, in ticks
+uint32_t generate_poisson_delay(void);
@@ -0,0 +1,112 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "dlog.h"
+
+#if defined(CONFIG_APP_LOG_TEXT) || defined(CONFIG_APP_LOG_DEFERRED)
+static const char *TAG = "FOSSOR";
+#endif
+
+#if defined(CONFIG_APP_LOG_TEXT) || (defined(CONFIG_APP_LOG_DEFERRED) && !defined(CONFIG_APP_LOG_DEFERRED_HEX))
+
+#define DLOG_FORMAT(id, fmt) fmt,
+static const char *const FORMATS[DLOG_COUNT] = {
+  DLOG_MESSAGES(DLOG_FORMAT)
+};
+#undef DLOG_FORMAT
+
+static void dlog_print(uint32_t timestamp_ms, dlog_id_t id, const uint32_t args[3]) {
+  char line[96];
+  // Unused arguments are ignored by the format
+  // The formats take l conversions, which are 64-bit on the linux target
+  snprintf(line, sizeof(line), FORMATS[id], (unsigned long)args[0], (unsigned long)args[1],
+           (unsigned long)args[2]);
+  esp_log_write(ESP_LOG_INFO, TAG, "I (%" PRIu32 ") %s: %s\n", timestamp_ms, TAG, line);
+}
+
+#endif
+
+#ifdef CONFIG_APP_LOG_TEXT
+
+void dlog_write(dlog_id_t id, const uint32_t args[3]) {
+  dlog_print(esp_log_timestamp(), id, args);
+}
+
+#endif
+
+#ifdef CONFIG_APP_LOG_DEFERRED
+
+// Named for extraction from a core dump or over JTAG
+dlog_record_t dlog_ring[CONFIG_APP_LOG_RING_RECORDS];
+static uint32_t s_head;
+static uint32_t s_tail;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void dlog_write(dlog_id_t id, const uint32_t args[3]) {
+  uint32_t now = esp_log_timestamp();
+  portENTER_CRITICAL(&s_lock);
+  dlog_record_t *rec = &dlog_ring[s_head % CONFIG_APP_LOG_RING_RECORDS];
+  rec->timestamp_ms = now;
+  rec->id = id;
+  rec->seq = (uint16_t)s_head;
+  rec->args[0] = args[0];
+  rec->args[1] = args[1];
+  rec->args[2] = args[2];
+  s_head++;
+  // Overwrite the oldest entry when full
+  if (s_head - s_tail > CONFIG_APP_LOG_RING_RECORDS) {
+    s_tail = s_head - CONFIG_APP_LOG_RING_RECORDS;
+  }
+  portEXIT_CRITICAL(&s_lock);
+}
+
+void dlog_flush(void) {
+  while (1) {
+    dlog_record_t rec;
+    portENTER_CRITICAL(&s_lock);
+    if (s_tail == s_head) {
+      portEXIT_CRITICAL(&s_lock);
+      break;
+    }
+    rec = dlog_ring[s_tail % CONFIG_APP_LOG_RING_RECORDS];
+    s_tail++;
+    portEXIT_CRITICAL(&s_lock);
+
+    #ifdef CONFIG_APP_LOG_DEFERRED_HEX
+      // Raw record for tools/dlog_decode.py, no formatting on the device
+      static const char DIGITS[] = "0123456789abcdef";
+      const uint8_t *raw = (const uint8_t *)&rec;
+      char hex[2 * sizeof(rec) + 1];
+      for (int i = 0; i < sizeof(rec); i++) {
+        hex[2 * i] = DIGITS[raw[i] >> 4];
+        hex[2 * i + 1] = DIGITS[raw[i] & 0xf];
+      }
+      hex[2 * sizeof(rec)] = '\0';
+      esp_log_write(ESP_LOG_INFO, TAG, "DLOG %s\n", hex);
+    #else
+      if (rec.id < DLOG_COUNT) {
+        dlog_print(rec.timestamp_ms, rec.id, rec.args);
+      }
+    #endif
+  }
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Hot-path logging. Call sites name a message by ID and pass up to three
+// 32-bit arguments; the format strings live only in the table below.
+//
+//   APP_LOG_TEXT      format and print at once, like ESP_LOGI
+//   APP_LOG_DEFERRED  store ID and raw arguments in a RAM ring, print it
+//                     with dlog_flush() once the publish cycle is over
+//   APP_LOG_NONE      compiled out
+//
+// Arguments reach the format as unsigned long, so use %lu, %lx or %lX.
+// tools/dlog_decode.py turns a dump of the ring back into text on a host.
+// Keep IDs in order: the decoder numbers the entries of this table.
+
+#define DLOG_MESSAGES(X) \
+  X(DLOG_STATE,               "STATE %lu -> %lu") \
+  X(DLOG_GENERATING_FIRST,    "GENERATING ENTROPY... PATIENCE IS ADVISED") \
+  X(DLOG_GENERATED,           "ENTROPY GENERATED") \
+  X(DLOG_SENDING,             "SENDING ENTROPY") \
+  X(DLOG_RECEIVED,            "ENTROPY RECEIVED [msg_id=%lu seq=%lu]") \
+  X(DLOG_ENTROPY,             "0x%08lX%08lX") \
+  X(DLOG_MQTT_DISCONNECTED,   "MQTT_EVENT_DISCONNECTED") \
+  X(DLOG_GENERATING_MORE,     "GENERATING SOME MORE ENTROPY... PATIENCE IS ADVISED")
+
+#define DLOG_ENUM(id, fmt) id,
+typedef enum {
+  DLOG_MESSAGES(DLOG_ENUM)
+  DLOG_COUNT
+} dlog_id_t;
+#undef DLOG_ENUM
+
+// One ring entry, little-endian as stored on the target
+typedef struct {
+  uint32_t timestamp_ms;
+  uint16_t id;
+  uint16_t seq;                 // Gaps show entries lost to overwriting
+  uint32_t args[3];
+} dlog_record_t;
+
+#if defined(CONFIG_APP_LOG_TEXT) || defined(CONFIG_APP_LOG_DEFERRED)
+
+void dlog_write(dlog_id_t id, const uint32_t args[3]);
+
+#define APP_LOG(id, ...) dlog_write(id, (const uint32_t[3]){ __VA_ARGS__ })
+
+#else
+
+#define APP_LOG(id, ...) do {} while (0)
+
+#endif
+
+#ifdef CONFIG_APP_LOG_DEFERRED
+// Print and empty the ring. Call when nothing time-critical is running.
+void dlog_flush(void);
+#else
+static inline void dlog_flush(void) {}
+#endif
@@ -0,0 +1,152 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <arpa/inet.h>
+#include <netdb.h>
+#else
+#include "lwip/netdb.h"
+#endif
+
+#include "dns_cache.h"
+
+#define DNS_CACHE_ENTRIES       4       // One per broker store entry
+#define DNS_CACHE_HOST_MAX      64
+#define DNS_CACHE_MAGIC         0x444e5343
+
+// lwIP does not hand out the record's TTL, so the configured age is the
+// limit. lwIP's own table still honours the TTL while the device runs.
+typedef struct {
+  char host[DNS_CACHE_HOST_MAX];        // Empty if unused
+  struct in_addr addr;
+  time_t resolved;                      // System time, kept across resets
+} dns_entry_t;
+
+typedef struct {
+  uint32_t magic;
+  dns_entry_t entries[DNS_CACHE_ENTRIES];
+  uint32_t checksum;
+} dns_cache_t;
+
+static RTC_NOINIT_ATTR dns_cache_t s_cache;
+
+static const char *TAG = "FOSSOR";
+
+// FNV-1a over everything but the checksum, so power-on garbage is ignored
+static uint32_t dns_cache_checksum(void) {
+  const uint8_t *p = (const uint8_t *)&s_cache;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < offsetof(dns_cache_t, checksum); i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+static void dns_cache_seal(void) {
+  s_cache.checksum = dns_cache_checksum();
+}
+
+static bool dns_cache_valid(void) {
+  if (s_cache.magic == DNS_CACHE_MAGIC && s_cache.checksum == dns_cache_checksum()) {
+    return true;
+  }
+  memset(&s_cache, 0, sizeof(s_cache));
+  s_cache.magic = DNS_CACHE_MAGIC;
+  dns_cache_seal();
+  return false;
+}
+
+static dns_entry_t *dns_cache_find(const char *host) {
+  for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+    if (strncmp(s_cache.entries[i].host, host, DNS_CACHE_HOST_MAX) == 0) {
+      return &s_cache.entries[i];
+    }
+  }
+  return NULL;
+}
+
+bool dns_cache_lookup(const char *host, struct in_addr *addr) {
+  bool cacheable = strlen(host) < DNS_CACHE_HOST_MAX && dns_cache_valid();
+  time_t now = time(NULL);
+  dns_entry_t *entry = cacheable ? dns_cache_find(host) : NULL;
+  // A clock that went backwards (e.g. set by SNTP) makes the age unknown
+  if (entry != NULL && now >= entry->resolved && now - entry->resolved < CONFIG_DNS_CACHE_TTL_S) {
+    *addr = entry->addr;
+    return true;
+  }
+
+  struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *res = NULL;
+  if (getaddrinfo(host, NULL, &hints, &res) != 0 || res == NULL) {
+    ESP_LOGE(TAG, "DNS LOOKUP FAILED [%s]", host);
+    return false;
+  }
+  *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+  freeaddrinfo(res);
+
+  if (cacheable && CONFIG_DNS_CACHE_TTL_S > 0) {
+    if (entry == NULL) {
+      // Reuse the oldest entry; unused ones are oldest of all
+      entry = &s_cache.entries[0];
+      for (int i = 1; i < DNS_CACHE_ENTRIES; i++) {
+        if (s_cache.entries[i].resolved < entry->resolved) {
+          entry = &s_cache.entries[i];
+        }
+      }
+    }
+    strncpy(entry->host, host, DNS_CACHE_HOST_MAX);
+    entry->addr = *addr;
+    entry->resolved = now;
+    dns_cache_seal();
+  }
+  return true;
+}
+
+void dns_cache_forget(const char *host) {
+  dns_entry_t *entry = dns_cache_valid() ? dns_cache_find(host) : NULL;
+  if (entry != NULL) {
+    memset(entry, 0, sizeof(*entry));
+    dns_cache_seal();
+  }
+}
+
+const char *dns_cache_resolve_uri(const char *uri, char *buf, size_t size, char *host, size_t host_size) {
+  const char *start = strstr(uri, "://");
+  start = start ? start + 3 : uri;
+  size_t len = strcspn(start, ":/");
+  host[0] = '\0';
+  if (len == 0 || len >= host_size) {
+    return uri;
+  }
+  memcpy(host, start, len);
+  host[len] = '\0';
+
+  struct in_addr addr;
+  char ip[INET_ADDRSTRLEN];
+  if (inet_pton(AF_INET, host, &addr) == 1 || !dns_cache_lookup(host, &addr) ||
+      inet_ntop(AF_INET, &addr, ip, sizeof(ip)) == NULL ||
+      snprintf(buf, size, "%.*s%s%s", (int)(start - uri), uri, ip, start + len) >= (int)size) {
+    // Leave resolving, and reporting the failure, to the client
+    host[0] = '\0';
+    return uri;
+  }
+  return buf;
+}
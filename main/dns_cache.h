@@ -0,0 +1,42 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <netinet/in.h>
+#else
+#include "lwip/sockets.h"
+#endif
+
+// Broker addresses, kept in RTC memory so a restart or a wake from deep
+// sleep can connect without a DNS round trip. Only used by the
+// connectivity task.
+
+// IPv4 address of host: from the cache while younger than
+// CONFIG_DNS_CACHE_TTL_S, otherwise resolved now and cached
+bool dns_cache_lookup(const char *host, struct in_addr *addr);
+
+// Drop host so the next lookup resolves it again, e.g. after a failed
+// connect
+void dns_cache_forget(const char *host);
+
+// Copy uri to buf with its host name replaced by the host's address, and
+// the name to host for TLS verification. Returns uri itself, with host
+// empty, when the host is already an address or cannot be resolved.
+const char *dns_cache_resolve_uri(const char *uri, char *buf, size_t size, char *host, size_t host_size);
@@ -0,0 +1,75 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "entropy_health.h"
+
+// Cutoffs for an assessed min-entropy of 4 bits per byte, well below what
+// the hardware RNG delivers, and a false positive rate of 2^-20.
+// RCT: 1 + ceil(20 / H). APT: critical binomial value for W = 512, p = 2^-H.
+#define RCT_CUTOFF              6
+#define APT_WINDOW              512
+#define APT_CUTOFF              63
+
+static uint8_t s_rct_last;
+static uint32_t s_rct_run;
+static uint8_t s_apt_symbol;
+static uint32_t s_apt_seen = APT_WINDOW;
+static uint32_t s_apt_count;
+static uint32_t s_status;
+static uint32_t s_failures;
+
+bool entropy_health_feed(const uint8_t *data, size_t len) {
+  uint32_t failed = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t b = data[i];
+
+    if (s_rct_run > 0 && b == s_rct_last) {
+      if (++s_rct_run >= RCT_CUTOFF) {
+        failed |= HEALTH_RCT_FAILED;
+        s_rct_run = 1;
+      }
+    } else {
+      s_rct_last = b;
+      s_rct_run = 1;
+    }
+
+    if (s_apt_seen >= APT_WINDOW) {
+      s_apt_symbol = b;
+      s_apt_count = 1;
+      s_apt_seen = 1;
+    } else {
+      s_apt_seen++;
+      if (b == s_apt_symbol && ++s_apt_count >= APT_CUTOFF) {
+        failed |= HEALTH_APT_FAILED;
+        s_apt_seen = APT_WINDOW;
+      }
+    }
+  }
+
+  if (failed) {
+    s_status |= failed;
+    s_failures++;
+  }
+  return failed == 0;
+}
+
+uint32_t entropy_health_status(void) {
+  return s_status;
+}
+
+uint32_t entropy_health_failures(void) {
+  return s_failures;
+}
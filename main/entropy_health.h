@@ -0,0 +1,38 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Continuous health tests on the raw entropy bytes (NIST SP 800-90B 4.4):
+// repetition count and adaptive proportion, 8-bit symbols.
+
+typedef enum {
+  HEALTH_RCT_FAILED = 1 << 0,           // Same byte repeated too often in a row
+  HEALTH_APT_FAILED = 1 << 1,           // One byte too common in a window
+} health_status_t;
+
+// Run the tests over a sample. Returns false if either test failed on it.
+bool entropy_health_feed(const uint8_t *data, size_t len);
+
+// Tests failed since boot, as health_status_t bits (0 = healthy)
+uint32_t entropy_health_status(void);
+
+// Number of samples that failed a test since boot
+uint32_t entropy_health_failures(void);
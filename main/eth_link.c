@@ -0,0 +1,80 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Wired link for running under QEMU, which emulates an open_eth NIC but no
+// Wi-Fi. Used by the soak test.
+
+#include "esp_eth.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+
+#include "net_link.h"
+#include "phase_trace.h"
+
+static const char *TAG = "FOSSOR";
+
+void net_link_handle(const conn_event_t *event)
+{
+}
+
+int net_link_rssi(void)
+{
+  return 0;
+}
+
+static void event_handler(void* arg, esp_event_base_t event_base,
+                                int32_t event_id, void* event_data)
+{
+  if (event_base == ETH_EVENT && event_id == ETHERNET_EVENT_CONNECTED) {
+    phase_trace_mark(PHASE_ASSOCIATED);
+    connectivity_post(CONN_EV_ASSOCIATED, 0);
+  } else if (event_base == ETH_EVENT && event_id == ETHERNET_EVENT_DISCONNECTED) {
+    phase_trace_mark(PHASE_LINK_START);
+    connectivity_post(CONN_EV_DISCONNECTED, 0);
+  } else if (event_base == IP_EVENT && event_id == IP_EVENT_ETH_GOT_IP) {
+    phase_trace_mark(PHASE_GOT_IP);
+    connectivity_post(CONN_EV_GOT_IP, 0);
+  }
+}
+
+void net_link_start(void)
+{
+  esp_netif_init();
+  esp_event_loop_create_default();
+
+  esp_netif_config_t netif_cfg = ESP_NETIF_DEFAULT_ETH();
+  esp_netif_t *eth_netif = esp_netif_new(&netif_cfg);
+  assert(eth_netif);
+
+  eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
+  eth_phy_config_t phy_config = ETH_PHY_DEFAULT_CONFIG();
+  phy_config.autonego_timeout_ms = 100;
+  esp_eth_mac_t *mac = esp_eth_mac_new_openeth(&mac_config);
+  esp_eth_phy_t *phy = esp_eth_phy_new_dp83848(&phy_config);
+
+  esp_eth_config_t config = ETH_DEFAULT_CONFIG(mac, phy);
+  esp_eth_handle_t eth_handle = NULL;
+  ESP_ERROR_CHECK(esp_eth_driver_install(&config, &eth_handle));
+  ESP_ERROR_CHECK(esp_netif_attach(eth_netif, esp_eth_new_netif_glue(eth_handle)));
+
+  esp_event_handler_register(ETH_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL);
+  esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &event_handler, NULL);
+
+  phase_trace_mark(PHASE_LINK_START);
+  ESP_LOGI(TAG, "Starting open_eth link");
+  esp_eth_start(eth_handle);
+}
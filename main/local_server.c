@@ -0,0 +1,242 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+
+#include "local_server.h"
+#include "sampler.h"
+
+#define LOCAL_SERVER_CLIENTS    8       // Rate limit state, least recently seen replaced
+#define LOCAL_SERVER_CHUNK      64      // Bytes generated per response chunk
+#define LOCAL_SERVER_PRIORITY   2       // Below the sampler and connectivity tasks
+#define LOCAL_SERVER_REPORT_S   60      // Served rate is logged at most this often
+
+// Token bucket of one client, in bytes. A full bucket holds one request of
+// CONFIG_LOCAL_SERVER_MAX_BYTES.
+typedef struct {
+  uint32_t addr;                        // IPv4 address, 0 if unused
+  float tokens;
+  int64_t updated_us;
+} local_client_t;
+
+static httpd_handle_t s_server;
+static local_client_t s_clients[LOCAL_SERVER_CLIENTS];
+
+// Served since the last rate report
+static uint64_t s_served_bytes;
+static int64_t s_busy_us;
+static int64_t s_report_us;
+
+static const char *TAG = "FOSSOR";
+
+// The server listens on IPv6 with IPv4 clients mapped into it. Keep the
+// low 32 bits, which are the IPv4 address of a mapped client.
+static uint32_t local_client_addr(httpd_req_t *req) {
+  struct sockaddr_storage peer;
+  socklen_t len = sizeof(peer);
+  if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&peer, &len) != 0) {
+    return 0;
+  }
+  uint32_t addr = 0;
+  if (peer.ss_family == AF_INET) {
+    addr = ((struct sockaddr_in *)&peer)->sin_addr.s_addr;
+  } else if (peer.ss_family == AF_INET6) {
+    memcpy(&addr, &((struct sockaddr_in6 *)&peer)->sin6_addr.s6_addr[12], sizeof(addr));
+  }
+  return addr;
+}
+
+// Take bytes from the client's bucket. Returns 0 if they were available,
+// else the seconds until they will be.
+static uint32_t local_client_charge(uint32_t addr, size_t bytes) {
+  int64_t now_us = esp_timer_get_time();
+  local_client_t *client = &s_clients[0];
+  for (int i = 0; i < LOCAL_SERVER_CLIENTS; i++) {
+    if (s_clients[i].addr == addr) {
+      client = &s_clients[i];
+      break;
+    } else if (s_clients[i].updated_us < client->updated_us) {
+      client = &s_clients[i];
+    }
+  }
+  if (client->addr != addr) {
+    client->addr = addr;
+    client->tokens = CONFIG_LOCAL_SERVER_MAX_BYTES;
+  } else {
+    client->tokens += (now_us - client->updated_us) * (CONFIG_LOCAL_SERVER_CLIENT_RATE / 1e6f);
+    if (client->tokens > CONFIG_LOCAL_SERVER_MAX_BYTES) {
+      client->tokens = CONFIG_LOCAL_SERVER_MAX_BYTES;
+    }
+  }
+  client->updated_us = now_us;
+  if (client->tokens < bytes) {
+    return (uint32_t)((bytes - client->tokens) / CONFIG_LOCAL_SERVER_CLIENT_RATE) + 1;
+  }
+  client->tokens -= bytes;
+  return 0;
+}
+
+static void local_server_hex(const uint8_t *data, size_t len, char *text) {
+  static const char DIGITS[] = "0123456789abcdef";
+  for (size_t i = 0; i < len; i++) {
+    text[2 * i] = DIGITS[data[i] >> 4];
+    text[2 * i + 1] = DIGITS[data[i] & 0xf];
+  }
+}
+
+// Log the served rate against the target. A server busy nearly all the
+// time is at its ceiling, so a rate below the target then means the target
+// cannot be met.
+static void local_server_account(size_t bytes, int64_t start_us) {
+  int64_t now_us = esp_timer_get_time();
+  s_served_bytes += bytes;
+  s_busy_us += now_us - start_us;
+  if (s_report_us == 0) {
+    s_report_us = start_us;
+  }
+  int64_t window_us = now_us - s_report_us;
+  if (window_us < LOCAL_SERVER_REPORT_S * 1000000LL) {
+    return;
+  }
+  uint32_t rate = (uint32_t)(s_served_bytes * 1000000 / window_us);
+  uint32_t busy = (uint32_t)(s_busy_us * 100 / window_us);
+  ESP_LOGI(TAG, "LOCAL SERVER SERVED [rate=%lu B/s target=%d B/s busy=%lu%%]", (unsigned long)rate,
+           CONFIG_LOCAL_SERVER_TARGET_RATE, (unsigned long)busy);
+  if (busy >= 90 && rate < CONFIG_LOCAL_SERVER_TARGET_RATE) {
+    ESP_LOGW(TAG, "LOCAL SERVER BELOW TARGET");
+  }
+  s_served_bytes = 0;
+  s_busy_us = 0;
+  s_report_us = now_us;
+}
+
+// Generate count blocks of bytes and send them a chunk at a time, so a
+// large request needs no large buffer. In hex, a batch has one block per
+// line. Returns the bytes sent.
+static size_t local_server_send(httpd_req_t *req, size_t bytes, int count, bool hex) {
+  uint8_t chunk[LOCAL_SERVER_CHUNK];
+  char text[2 * LOCAL_SERVER_CHUNK];
+  size_t sent = 0;
+  for (int block = 0; block < count; block++) {
+    for (size_t done = 0; done < bytes; ) {
+      size_t n = bytes - done < sizeof(chunk) ? bytes - done : sizeof(chunk);
+      if (!sampler_fill(chunk, n)) {
+        memset(chunk, 0, sizeof(chunk));
+        return sent;
+      }
+      esp_err_t err;
+      if (hex) {
+        local_server_hex(chunk, n, text);
+        err = httpd_resp_send_chunk(req, text, 2 * n);
+      } else {
+        err = httpd_resp_send_chunk(req, (const char *)chunk, n);
+      }
+      if (err != ESP_OK) {
+        memset(chunk, 0, sizeof(chunk));
+        return sent;
+      }
+      done += n;
+      sent += n;
+    }
+    if (hex && count > 1 && httpd_resp_send_chunk(req, "\n", 1) != ESP_OK) {
+      break;
+    }
+  }
+  memset(chunk, 0, sizeof(chunk));
+  return sent;
+}
+
+// Handlers run in the server's own task, one request at a time
+static esp_err_t random_get_handler(httpd_req_t *req) {
+  int64_t start_us = esp_timer_get_time();
+  size_t bytes = CONFIG_LOCAL_SERVER_DEFAULT_BYTES;
+  long count = 1;
+  bool hex = false;
+  char query[64];
+  char value[12];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "bytes", value, sizeof(value)) == ESP_OK) {
+      bytes = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "count", value, sizeof(value)) == ESP_OK) {
+      count = strtol(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK) {
+      hex = strcmp(value, "hex") == 0;
+    }
+  }
+  if (bytes == 0 || bytes > CONFIG_LOCAL_SERVER_MAX_BYTES) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bytes out of range");
+    return ESP_FAIL;
+  }
+  // A batch is charged and capped as one request of all its bytes
+  if (count < 1 || count > CONFIG_LOCAL_SERVER_MAX_BYTES / bytes) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "count out of range");
+    return ESP_FAIL;
+  }
+
+  uint32_t retry_s = local_client_charge(local_client_addr(req), bytes * count);
+  if (retry_s > 0) {
+    snprintf(value, sizeof(value), "%lu", (unsigned long)retry_s);
+    httpd_resp_set_status(req, "429 Too Many Requests");
+    httpd_resp_set_hdr(req, "Retry-After", value);
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+  }
+
+  httpd_resp_set_type(req, hex ? "text/plain" : "application/octet-stream");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+  size_t sent = local_server_send(req, bytes, count, hex);
+  local_server_account(sent, start_us);
+  if (sent < bytes * count) {
+    if (sent == 0) {
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "entropy health test failed");
+    }
+    // Otherwise closing the connection cuts the response short
+    return ESP_FAIL;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+void local_server_start(void) {
+  if (s_server != NULL) {
+    return;
+  }
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = CONFIG_LOCAL_SERVER_PORT;
+  config.task_priority = LOCAL_SERVER_PRIORITY;
+  config.max_open_sockets = 3;
+  config.lru_purge_enable = true;
+  esp_err_t err = httpd_start(&s_server, &config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "LOCAL SERVER NOT STARTED [%s]", esp_err_to_name(err));
+    s_server = NULL;
+    return;
+  }
+  static const httpd_uri_t random_uri = {
+    .uri = "/random",
+    .method = HTTP_GET,
+    .handler = random_get_handler,
+  };
+  httpd_register_uri_handler(s_server, &random_uri);
+  ESP_LOGI(TAG, "LOCAL SERVER LISTENING [port=%d]", CONFIG_LOCAL_SERVER_PORT);
+}
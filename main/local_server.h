@@ -0,0 +1,28 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+// HTTP endpoint for on-premise clients: GET /random?bytes=N[&count=M]
+// [&format=hex] returns M blocks of N bytes from the sample pipeline, rate
+// limited per client.
+
+#ifdef CONFIG_LOCAL_SERVER
+// Start the server. Does nothing if it is already running.
+void local_server_start(void);
+#else
+static inline void local_server_start(void) {}
+#endif
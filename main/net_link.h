@@ -0,0 +1,31 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "connectivity.h"
+
+// Network link below the connectivity state machine: Wi-Fi on devices
+// (wifi_link.c), or the QEMU open_eth NIC (eth_link.c).
+
+// Bring the link up. Driver events are forwarded to the connectivity queue.
+void net_link_start(void);
+
+// Link side of a connectivity event. Runs in the connectivity task.
+void net_link_handle(const conn_event_t *event);
+
+// Signal strength of the current link in dBm, 0 if not applicable
+int net_link_rssi(void);
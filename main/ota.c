@@ -0,0 +1,458 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_app_desc.h"
+#include "esp_attr.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "rom/miniz.h"
+
+#include "connectivity.h"
+#include "device_certs.h"
+#include "ota.h"
+#include "task_table.h"
+
+// Update container, little-endian, built by tools/ota_pack.py. The header
+// is followed by the payload: the image itself, or a bsdiff patch against
+// the running image as an interleaved stream of control triples, diff and
+// extra bytes (the ENDSLEY/BSDIFF43 body). Either may be zlib-compressed.
+#define OTA_MAGIC               0x41544f46      // "FOTA"
+#define OTA_FORMAT_VERSION      1
+#define OTA_ENCODING_FULL       0
+#define OTA_ENCODING_DELTA      1
+#define OTA_COMPRESSION_NONE    0
+#define OTA_COMPRESSION_ZLIB    1
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t encoding;
+  uint8_t compression;
+  uint8_t reserved;
+  uint32_t image_size;                  // Size of the rebuilt image
+  uint8_t base_elf_sha256[32];          // Delta only: ELF SHA-256 of the base
+  uint8_t image_sha256[32];             // Of the rebuilt image
+} ota_header_t;
+
+#define OTA_RECV_BUFFER         2048
+#define OTA_WRITE_BUFFER        4096    // One flash sector per write
+#define OTA_BASE_CHUNK          256
+#define OTA_HTTP_TIMEOUT_MS     10000
+#define OTA_REPORT_MAGIC        0x4f544152
+
+// Decoder state: container header, inflate, patch, then flash
+typedef struct {
+  ota_header_t header;
+  size_t header_len;
+  uint32_t downloaded;
+  const esp_partition_t *update;
+  esp_ota_handle_t handle;              // 0 while no update is open
+
+  // zlib. The window is the output buffer, so it must hold 32 KB.
+  tinfl_decompressor *inflator;
+  uint8_t *dict;
+  size_t dict_ofs;
+  bool inflated;                        // End of the zlib stream seen
+
+  // Delta
+  const esp_partition_t *base;
+  int64_t base_pos;                     // Where the next add block starts
+  uint32_t add_pos;
+  uint32_t add_left;
+  uint32_t copy_left;
+  uint8_t control[24];
+  size_t control_len;
+  uint8_t old[OTA_BASE_CHUNK];
+
+  // Flash
+  uint8_t out[OTA_WRITE_BUFFER];
+  size_t out_len;
+  uint32_t written;
+  mbedtls_sha256_context sha;
+  uint8_t recv[OTA_RECV_BUFFER];
+} ota_stream_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t partition;                   // Address of the updated partition
+  ota_stats_t stats;
+} ota_report_t;
+
+// Survives the restart into the new image
+static RTC_NOINIT_ATTR ota_report_t s_report;
+
+static ota_stream_t s_stream;
+static TaskHandle_t s_task;
+static atomic_bool s_busy;
+static uint32_t s_cycles;
+static bool s_confirmed;
+
+static const char *TAG = "FOSSOR";
+
+static esp_err_t stream_flush(ota_stream_t *s) {
+  if (s->out_len == 0) {
+    return ESP_OK;
+  }
+  mbedtls_sha256_update(&s->sha, s->out, s->out_len);
+  esp_err_t err = esp_ota_write(s->handle, s->out, s->out_len);
+  s->written += s->out_len;
+  s->out_len = 0;
+  return err;
+}
+
+// Append rebuilt image bytes
+static esp_err_t stream_emit(ota_stream_t *s, const uint8_t *data, size_t len) {
+  if (len > s->header.image_size - s->written - s->out_len) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  while (len > 0) {
+    size_t n = MIN(len, sizeof(s->out) - s->out_len);
+    memcpy(s->out + s->out_len, data, n);
+    s->out_len += n;
+    data += n;
+    len -= n;
+    if (s->out_len == sizeof(s->out)) {
+      esp_err_t err = stream_flush(s);
+      if (err != ESP_OK) {
+        return err;
+      }
+    }
+  }
+  return ESP_OK;
+}
+
+// bsdiff's sign-and-magnitude 64-bit integer
+static int64_t offtin(const uint8_t *buf) {
+  int64_t y = buf[7] & 0x7f;
+  for (int i = 6; i >= 0; i--) {
+    y = y * 256 + buf[i];
+  }
+  return (buf[7] & 0x80) ? -y : y;
+}
+
+static esp_err_t stream_patch(ota_stream_t *s, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    size_t n;
+    if (s->add_left > 0) {
+      // Diff bytes are added to the base image
+      n = MIN(MIN(len, s->add_left), sizeof(s->old));
+      esp_err_t err = esp_partition_read(s->base, s->add_pos, s->old, n);
+      for (size_t i = 0; err == ESP_OK && i < n; i++) {
+        s->old[i] += data[i];
+      }
+      if (err == ESP_OK) {
+        err = stream_emit(s, s->old, n);
+      }
+      if (err != ESP_OK) {
+        return err;
+      }
+      s->add_pos += n;
+      s->add_left -= n;
+    } else if (s->copy_left > 0) {
+      // Extra bytes are new
+      n = MIN(len, s->copy_left);
+      esp_err_t err = stream_emit(s, data, n);
+      if (err != ESP_OK) {
+        return err;
+      }
+      s->copy_left -= n;
+    } else {
+      n = MIN(len, sizeof(s->control) - s->control_len);
+      memcpy(s->control + s->control_len, data, n);
+      s->control_len += n;
+      if (s->control_len == sizeof(s->control)) {
+        s->control_len = 0;
+        int64_t add = offtin(s->control);
+        int64_t copy = offtin(s->control + 8);
+        int64_t seek = offtin(s->control + 16);
+        int64_t left = s->header.image_size - s->written - s->out_len;
+        int64_t next = s->base_pos + add + seek;
+        if (add < 0 || copy < 0 || add + copy > left || s->base_pos + add > s->base->size ||
+            next < 0 || next > s->base->size) {
+          return ESP_ERR_INVALID_ARG;
+        }
+        s->add_pos = s->base_pos;
+        s->add_left = add;
+        s->copy_left = copy;
+        s->base_pos = next;
+      }
+    }
+    data += n;
+    len -= n;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t stream_decode(ota_stream_t *s, const uint8_t *data, size_t len) {
+  if (s->header.encoding == OTA_ENCODING_DELTA) {
+    return stream_patch(s, data, len);
+  }
+  return stream_emit(s, data, len);
+}
+
+static esp_err_t stream_inflate(ota_stream_t *s, const uint8_t *data, size_t len) {
+  while (!s->inflated) {
+    size_t in_len = len;
+    size_t out_len = TINFL_LZ_DICT_SIZE - s->dict_ofs;
+    tinfl_status status = tinfl_decompress(s->inflator, data, &in_len, s->dict, s->dict + s->dict_ofs, &out_len,
+                                           TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+    data += in_len;
+    len -= in_len;
+    esp_err_t err = stream_decode(s, s->dict + s->dict_ofs, out_len);
+    if (err != ESP_OK) {
+      return err;
+    }
+    s->dict_ofs = (s->dict_ofs + out_len) & (TINFL_LZ_DICT_SIZE - 1);
+    if (status < TINFL_STATUS_DONE) {
+      return ESP_ERR_INVALID_RESPONSE;
+    } else if (status == TINFL_STATUS_DONE) {
+      s->inflated = true;
+    } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+      // Everything given has been consumed
+      return ESP_OK;
+    }
+  }
+  // Nothing may follow the zlib stream
+  return len == 0 ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+// Check the header and open the update partition
+static esp_err_t stream_begin(ota_stream_t *s) {
+  const ota_header_t *h = &s->header;
+  if (h->magic != OTA_MAGIC || h->version != OTA_FORMAT_VERSION || h->encoding > OTA_ENCODING_DELTA ||
+      h->compression > OTA_COMPRESSION_ZLIB) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  s->update = esp_ota_get_next_update_partition(NULL);
+  if (s->update == NULL || h->image_size > s->update->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (h->encoding == OTA_ENCODING_DELTA) {
+    // A patch only rebuilds the image it was made against
+    if (memcmp(h->base_elf_sha256, esp_app_get_description()->app_elf_sha256, sizeof(h->base_elf_sha256)) != 0) {
+      return ESP_ERR_INVALID_VERSION;
+    }
+    s->base = esp_ota_get_running_partition();
+  }
+  if (h->compression == OTA_COMPRESSION_ZLIB) {
+    // Only needed during an update, so taken from the heap
+    s->inflator = malloc(sizeof(tinfl_decompressor));
+    s->dict = malloc(TINFL_LZ_DICT_SIZE);
+    if (s->inflator == NULL || s->dict == NULL) {
+      return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(s->inflator);
+  }
+  ESP_LOGI(TAG, "OTA STARTED [%s, %s, image=%" PRIu32 "]", h->encoding == OTA_ENCODING_DELTA ? "delta" : "full",
+           h->compression == OTA_COMPRESSION_ZLIB ? "zlib" : "raw", h->image_size);
+  // Erase sector by sector while writing rather than all up front
+  return esp_ota_begin(s->update, OTA_WITH_SEQUENTIAL_WRITES, &s->handle);
+}
+
+static esp_err_t stream_feed(ota_stream_t *s, const uint8_t *data, size_t len) {
+  s->downloaded += len;
+  if (s->header_len < sizeof(s->header)) {
+    size_t n = MIN(len, sizeof(s->header) - s->header_len);
+    memcpy((uint8_t *)&s->header + s->header_len, data, n);
+    s->header_len += n;
+    data += n;
+    len -= n;
+    if (s->header_len < sizeof(s->header)) {
+      return ESP_OK;
+    }
+    esp_err_t err = stream_begin(s);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  if (len == 0) {
+    return ESP_OK;
+  }
+  if (s->header.compression == OTA_COMPRESSION_ZLIB) {
+    return stream_inflate(s, data, len);
+  }
+  return stream_decode(s, data, len);
+}
+
+// Check the rebuilt image and make it the boot image
+static esp_err_t stream_finish(ota_stream_t *s) {
+  bool compressed = s->header.compression == OTA_COMPRESSION_ZLIB;
+  if (s->handle == 0 || (compressed && !s->inflated) || s->add_left > 0 || s->copy_left > 0 ||
+      s->control_len > 0) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  esp_err_t err = stream_flush(s);
+  if (err != ESP_OK) {
+    return err;
+  }
+  if (s->written != s->header.image_size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&s->sha, digest);
+  if (memcmp(digest, s->header.image_sha256, sizeof(digest)) != 0) {
+    return ESP_ERR_INVALID_CRC;
+  }
+  // Verifies the image, and its signature when signed images are enabled
+  err = esp_ota_end(s->handle);
+  s->handle = 0;
+  if (err != ESP_OK) {
+    return err;
+  }
+  return esp_ota_set_boot_partition(s->update);
+}
+
+static void stream_release(ota_stream_t *s) {
+  if (s->handle != 0) {
+    esp_ota_abort(s->handle);
+  }
+  free(s->inflator);
+  free(s->dict);
+  mbedtls_sha256_free(&s->sha);
+}
+
+// Ask the server for an update and install it. ESP_ERR_NOT_FOUND if there
+// is none.
+static esp_err_t ota_update(ota_stream_t *s) {
+  memset(s, 0, sizeof(*s));
+  mbedtls_sha256_init(&s->sha);
+  mbedtls_sha256_starts(&s->sha, 0);
+
+  // The server picks a delta against the image identified here
+  char elf_sha256[65];
+  esp_app_get_elf_sha256(elf_sha256, sizeof(elf_sha256));
+  esp_http_client_config_t http_cfg = {
+    .url = CONFIG_OTA_URL,
+    .cert_pem = root_CA_crt,
+    .client_cert_pem = const_cert_pem,
+    .client_key_pem = const_private_key,
+    .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+  };
+  esp_http_client_handle_t http = esp_http_client_init(&http_cfg);
+  if (http == NULL) {
+    stream_release(s);
+    return ESP_ERR_NO_MEM;
+  }
+  esp_http_client_set_header(http, "X-Fossor-Elf-Sha256", elf_sha256);
+  esp_http_client_set_header(http, "X-Fossor-Version", esp_app_get_description()->version);
+
+  int64_t start_us = esp_timer_get_time();
+  esp_err_t err = esp_http_client_open(http, 0);
+  if (err == ESP_OK) {
+    esp_http_client_fetch_headers(http);
+    int status = esp_http_client_get_status_code(http);
+    if (status == 204 || status == 304) {
+      err = ESP_ERR_NOT_FOUND;
+    } else if (status != 200) {
+      ESP_LOGE(TAG, "OTA SERVER ERROR [status=%d]", status);
+      err = ESP_FAIL;
+    }
+  }
+  // Straight from the socket to flash, one receive buffer at a time
+  while (err == ESP_OK) {
+    int n = esp_http_client_read(http, (char *)s->recv, sizeof(s->recv));
+    if (n < 0) {
+      err = ESP_FAIL;
+    } else if (n == 0) {
+      err = esp_http_client_is_complete_data_received(http) ? stream_finish(s) : ESP_ERR_INVALID_SIZE;
+      break;
+    } else {
+      err = stream_feed(s, s->recv, n);
+    }
+  }
+  esp_http_client_close(http);
+  esp_http_client_cleanup(http);
+  stream_release(s);
+
+  if (err == ESP_OK) {
+    s_report.magic = OTA_REPORT_MAGIC;
+    s_report.partition = s->update->address;
+    s_report.stats.downloaded = s->downloaded;
+    s_report.stats.image_size = s->written;
+    s_report.stats.apply_ms = (esp_timer_get_time() - start_us) / 1000;
+    ESP_LOGI(TAG, "OTA APPLIED [downloaded=%" PRIu32 " image=%" PRIu32 " ms=%" PRIu32 "]", s_report.stats.downloaded,
+             s_report.stats.image_size, s_report.stats.apply_ms);
+  }
+  return err;
+}
+
+void ota_task(void *pvParameters) {
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    esp_err_t err = ota_update(&s_stream);
+    if (err == ESP_OK) {
+      ESP_LOGI(TAG, "RESTARTING INTO NEW FIRMWARE");
+      esp_restart();
+    } else if (err != ESP_ERR_NOT_FOUND) {
+      ESP_LOGE(TAG, "OTA FAILED [%s]", esp_err_to_name(err));
+    }
+    atomic_store(&s_busy, false);
+    connectivity_post(CONN_EV_OTA_DONE, 0);
+  }
+}
+
+void ota_start(void) {
+  // Keep the report only while running the image it describes
+  if (s_report.magic != OTA_REPORT_MAGIC || s_report.partition != esp_ota_get_running_partition()->address) {
+    memset(&s_report, 0, sizeof(s_report));
+  }
+  s_task = app_task_start(APP_TASK_OTA, NULL);
+}
+
+void ota_cycle_done(void) {
+  if (s_cycles++ % CONFIG_OTA_CHECK_INTERVAL != 0 || CONFIG_OTA_URL[0] == '\0') {
+    return;
+  }
+  atomic_store(&s_busy, true);
+  xTaskNotifyGive(s_task);
+}
+
+bool ota_busy(void) {
+  return atomic_load(&s_busy);
+}
+
+void ota_confirm(void) {
+  if (s_confirmed) {
+    return;
+  }
+  s_confirmed = true;
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+      state == ESP_OTA_IMG_PENDING_VERIFY) {
+    esp_ota_mark_app_valid_cancel_rollback();
+    ESP_LOGI(TAG, "NEW FIRMWARE CONFIRMED");
+  }
+}
+
+bool ota_last_update(ota_stats_t *stats) {
+  if (s_report.magic != OTA_REPORT_MAGIC) {
+    return false;
+  }
+  *stats = s_report.stats;
+  return true;
+}
@@ -0,0 +1,61 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Firmware updates over the air, checked every CONFIG_OTA_CHECK_INTERVAL
+// publish cycles. An update is a full or delta image, optionally
+// zlib-compressed, streamed into the inactive OTA partition.
+
+typedef struct {
+  uint32_t downloaded;                  // Bytes received from the server
+  uint32_t image_size;                  // Bytes written to flash
+  uint32_t apply_ms;                    // Request to boot partition switch
+} ota_stats_t;
+
+#ifdef CONFIG_OTA_UPDATE
+
+// Create the update task
+void ota_start(void);
+
+// Count a publish cycle and start a check when one is due. Called by the
+// connectivity task; CONN_EV_OTA_DONE follows unless an update was applied.
+void ota_cycle_done(void);
+
+// A check or download is running. No MQTT session is opened meanwhile.
+bool ota_busy(void);
+
+// The running image has published a sample, so keep it
+void ota_confirm(void);
+
+// Stats of the update that produced the running image, false if none
+bool ota_last_update(ota_stats_t *stats);
+
+// Task body, listed in the task table
+void ota_task(void *pvParameters);
+
+#else
+
+static inline void ota_start(void) {}
+static inline void ota_cycle_done(void) {}
+static inline bool ota_busy(void) { return false; }
+static inline void ota_confirm(void) {}
+static inline bool ota_last_update(ota_stats_t *stats) { return false; }
+
+#endif
@@ -0,0 +1,167 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "phase_trace.h"
+
+#ifdef CONFIG_PHASE_TRACE
+
+// Log-scale histogram: 4 buckets per octave from 1 ms to ~67 s
+#define HIST_MIN_SHIFT          10
+#define HIST_SUB_BITS           2
+#define HIST_BUCKETS            64
+
+static const char *const PHASE_NAMES[PHASE_COUNT] = {
+  "LINK_START", "SCAN", "ASSOC", "GOT_IP", "WAKE", "DNS", "CONNACK", "PUBLISH", "PUBACK",
+};
+
+static trace_record_t s_ring[CONFIG_PHASE_TRACE_RECORDS];
+static uint32_t s_ring_head;
+static int64_t s_last_us[PHASE_COUNT];
+static uint16_t s_hist[PHASE_COUNT][HIST_BUCKETS];
+static uint8_t s_cycle;
+static uint32_t s_cycles_since_report;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *TAG = "FOSSOR";
+
+static int hist_bucket(uint32_t us) {
+  if (us < (1u << HIST_MIN_SHIFT)) {
+    return 0;
+  }
+  int msb = 31 - __builtin_clz(us);
+  int sub = (us >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+  int bucket = ((msb - HIST_MIN_SHIFT) << HIST_SUB_BITS) + sub;
+  return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+// Midpoint of a bucket in microseconds
+static uint32_t hist_value(int bucket) {
+  int octave = bucket >> HIST_SUB_BITS;
+  int sub = bucket & ((1 << HIST_SUB_BITS) - 1);
+  uint32_t base = 1u << (octave + HIST_MIN_SHIFT - HIST_SUB_BITS);
+  return ((1u << HIST_SUB_BITS) + sub) * base + base / 2;
+}
+
+void phase_trace_mark(trace_phase_t phase) {
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&s_lock);
+  // Span starts at the nearest earlier phase seen since our own last mark
+  uint32_t span = 0;
+  if (phase != PHASE_LINK_START && phase != PHASE_WAKE) {
+    for (int from = (int)phase - 1; from >= 0; from--) {
+      if (s_last_us[from] > s_last_us[phase]) {
+        span = (uint32_t)(now - s_last_us[from]);
+        break;
+      }
+      if (from == PHASE_LINK_START || from == PHASE_WAKE) {
+        break;
+      }
+    }
+  }
+  s_last_us[phase] = now;
+  if (phase == PHASE_WAKE) {
+    s_cycle++;
+  }
+
+  trace_record_t *rec = &s_ring[s_ring_head % CONFIG_PHASE_TRACE_RECORDS];
+  rec->timestamp_us = (uint32_t)now;
+  rec->span_us = span;
+  rec->phase = phase;
+  rec->cycle = s_cycle;
+  rec->reserved = 0;
+  s_ring_head++;
+
+  if (span > 0) {
+    uint16_t *count = &s_hist[phase][hist_bucket(span)];
+    if (*count < UINT16_MAX) {
+      (*count)++;
+    }
+  }
+  portEXIT_CRITICAL(&s_lock);
+}
+
+int phase_trace_snapshot(trace_record_t *out, int max_records) {
+  portENTER_CRITICAL(&s_lock);
+  uint32_t n = s_ring_head < CONFIG_PHASE_TRACE_RECORDS ? s_ring_head : CONFIG_PHASE_TRACE_RECORDS;
+  if (n > (uint32_t)max_records) {
+    n = max_records;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    out[i] = s_ring[(s_ring_head - n + i) % CONFIG_PHASE_TRACE_RECORDS];
+  }
+  portEXIT_CRITICAL(&s_lock);
+  return n;
+}
+
+static uint32_t hist_percentile(const uint16_t *hist, uint32_t total, uint32_t pct) {
+  uint32_t rank = (total * pct + 99) / 100;
+  uint32_t seen = 0;
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    seen += hist[b];
+    if (seen >= rank) {
+      return hist_value(b);
+    }
+  }
+  return hist_value(HIST_BUCKETS - 1);
+}
+
+bool phase_trace_percentiles(trace_phase_t phase, uint32_t *count, uint32_t pct[3]) {
+  uint16_t hist[HIST_BUCKETS];
+  portENTER_CRITICAL(&s_lock);
+  memcpy(hist, s_hist[phase], sizeof(hist));
+  portEXIT_CRITICAL(&s_lock);
+
+  uint32_t total = 0;
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    total += hist[b];
+  }
+  *count = total;
+  if (total == 0) {
+    return false;
+  }
+  pct[0] = hist_percentile(hist, total, 50);
+  pct[1] = hist_percentile(hist, total, 95);
+  pct[2] = hist_percentile(hist, total, 99);
+  return true;
+}
+
+const char *phase_trace_name(trace_phase_t phase) {
+  return phase < PHASE_COUNT ? PHASE_NAMES[phase] : "?";
+}
+
+void phase_trace_cycle_done(void) {
+  if (++s_cycles_since_report < CONFIG_PHASE_TRACE_REPORT_CYCLES) {
+    return;
+  }
+  s_cycles_since_report = 0;
+
+  for (int p = 0; p < PHASE_COUNT; p++) {
+    uint32_t total, pct[3];
+    if (phase_trace_percentiles(p, &total, pct)) {
+      ESP_LOGI(TAG, "PHASE %-10s n=%" PRIu32 " p50=%" PRIu32 "us p95=%" PRIu32 "us p99=%" PRIu32 "us", PHASE_NAMES[p], total,
+               pct[0], pct[1], pct[2]);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,71 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Points on the way from wake-up to PUBACK. The span of a phase runs from
+// the most recent earlier phase of its group to the phase itself; the Wi-Fi
+// group starts at PHASE_LINK_START, the publish group at PHASE_WAKE.
+typedef enum {
+  PHASE_LINK_START,       // Wi-Fi started or link lost
+  PHASE_SCAN_DONE,
+  PHASE_ASSOCIATED,
+  PHASE_GOT_IP,
+  PHASE_WAKE,             // Poisson delay expired
+  PHASE_DNS,
+  PHASE_CONNACK,          // TCP connect, TLS handshake and MQTT CONNECT
+  PHASE_PUBLISH,
+  PHASE_PUBACK,
+  PHASE_COUNT
+} trace_phase_t;
+
+// One entry of the binary trace buffer
+typedef struct {
+  uint32_t timestamp_us;  // Low 32 bits of esp_timer_get_time()
+  uint32_t span_us;       // 0 if the phase had no predecessor this cycle
+  uint8_t phase;
+  uint8_t cycle;
+  uint16_t reserved;
+} trace_record_t;
+
+#ifdef CONFIG_PHASE_TRACE
+
+void phase_trace_mark(trace_phase_t phase);
+
+// Called once per publish cycle, prints percentiles every N cycles
+void phase_trace_cycle_done(void);
+
+// Copy out the trace ring, oldest first. Returns the number of records.
+int phase_trace_snapshot(trace_record_t *out, int max_records);
+
+// Span percentiles of a phase since boot, in microseconds. Returns false
+// if the phase has no spans yet.
+bool phase_trace_percentiles(trace_phase_t phase, uint32_t *count, uint32_t pct[3]);
+
+const char *phase_trace_name(trace_phase_t phase);
+
+#else
+
+static inline void phase_trace_mark(trace_phase_t phase) {}
+static inline void phase_trace_cycle_done(void) {}
+static inline int phase_trace_snapshot(trace_record_t *out, int max_records) { return 0; }
+static inline bool phase_trace_percentiles(trace_phase_t phase, uint32_t *count, uint32_t pct[3]) { return false; }
+static inline const char *phase_trace_name(trace_phase_t phase) { return "?"; }
+
+#endif
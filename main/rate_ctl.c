@@ -0,0 +1,78 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <math.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "rate_ctl.h"
+
+#define RATE_CTL_ALPHA          0.25f   // Weight of the newest session
+// Link quality runs from 1 at the good end of each range to 0 at the poor
+// end. The worst of the three sets the batch.
+#define RATE_CTL_RSSI_GOOD      -67
+#define RATE_CTL_RSSI_POOR      -85
+#define RATE_CTL_LATENCY_GOOD_MS    2000
+#define RATE_CTL_LATENCY_POOR_MS    10000
+#define RATE_CTL_FAILURES_POOR  0.5f    // Share of sessions failing
+// Flush a held batch once this share of the arena is taken, before new
+// samples are dropped for want of a slot
+#define RATE_CTL_ARENA_FLUSH    0.75f
+
+static float s_failure_rate;
+static float s_latency_ms;              // 0 until a session succeeds
+static int s_target = 1;                // Samples to wait for
+static int64_t s_hold_us;               // Longest a sample waits for the rest
+
+static const char *TAG = "FOSSOR";
+
+// 1 at good, 0 at poor, linear in between
+static float rate_ctl_scale(float value, float good, float poor) {
+  float score = (value - poor) / (good - poor);
+  return score < 0 ? 0 : score > 1 ? 1 : score;
+}
+
+void rate_ctl_record(bool published, uint32_t latency_ms, int rssi) {
+  s_failure_rate += RATE_CTL_ALPHA * ((published ? 0.0f : 1.0f) - s_failure_rate);
+  if (published) {
+    s_latency_ms = s_latency_ms == 0 ? latency_ms : s_latency_ms + RATE_CTL_ALPHA * (latency_ms - s_latency_ms);
+  }
+
+  float quality = rate_ctl_scale(s_failure_rate, 0, RATE_CTL_FAILURES_POOR);
+  if (s_latency_ms > 0) {
+    quality = fminf(quality, rate_ctl_scale(s_latency_ms, RATE_CTL_LATENCY_GOOD_MS, RATE_CTL_LATENCY_POOR_MS));
+  }
+  if (rssi != 0) {
+    quality = fminf(quality, rate_ctl_scale(rssi, RATE_CTL_RSSI_GOOD, RATE_CTL_RSSI_POOR));
+  }
+
+  int target = 1 + (int)lroundf((1 - quality) * (RATE_CTL_BATCH_MAX - 1));
+  s_hold_us = (int64_t)((1 - quality) * CONFIG_BATCH_MAX_HOLD_MIN * 60e6f);
+  if (target != s_target) {
+    ESP_LOGI(TAG, "RATE CONTROL [batch=%d hold=%lus quality=%d%%]", target,
+             (unsigned long)(s_hold_us / 1000000), (int)(quality * 100));
+    s_target = target;
+  }
+}
+
+int64_t rate_ctl_flush_time(int count, int64_t oldest_us, int arena_used) {
+  if (count >= s_target || count >= RATE_CTL_BATCH_MAX ||
+      arena_used >= CONFIG_SAMPLE_ARENA_SLOTS * RATE_CTL_ARENA_FLUSH) {
+    return 0;
+  }
+  int64_t flush_us = oldest_us + s_hold_us;
+  return flush_us > esp_timer_get_time() ? flush_us : 0;
+}
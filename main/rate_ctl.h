@@ -0,0 +1,51 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Adaptive batching. Samples are still generated on the Poisson schedule;
+// only their publication is grouped. On a good link every sample goes out
+// as soon as it is ready. As RSSI, session latency and failures get worse,
+// the controller waits for larger batches, holding a sample for up to
+// CONFIG_BATCH_MAX_HOLD_MIN.
+
+#ifdef CONFIG_ADAPTIVE_BATCHING
+
+// Most samples in one publish. A held batch takes at most half the arena,
+// so new samples always find a slot.
+#define RATE_CTL_ARENA_HALF     (CONFIG_SAMPLE_ARENA_SLOTS / 2 > 0 ? CONFIG_SAMPLE_ARENA_SLOTS / 2 : 1)
+#define RATE_CTL_BATCH_MAX      (CONFIG_BATCH_MAX < RATE_CTL_ARENA_HALF ? CONFIG_BATCH_MAX : RATE_CTL_ARENA_HALF)
+
+// Fold in the outcome of a session. latency_ms runs from starting the
+// session to the broker's acknowledgement; rssi is 0 if unknown.
+void rate_ctl_record(bool published, uint32_t latency_ms, int rssi);
+
+// When a batch of count samples, the oldest generated at oldest_us, should
+// go out. 0 means now. arena_used is the number of arena slots taken; a
+// batch goes out early once they fill up.
+int64_t rate_ctl_flush_time(int count, int64_t oldest_us, int arena_used);
+
+#else
+
+#define RATE_CTL_BATCH_MAX      1
+
+static inline void rate_ctl_record(bool published, uint32_t latency_ms, int rssi) {}
+static inline int64_t rate_ctl_flush_time(int count, int64_t oldest_us, int arena_used) { return 0; }
+
+#endif
@@ -0,0 +1,64 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "sample_arena.h"
+
+static sample_slot_t s_slots[CONFIG_SAMPLE_ARENA_SLOTS];
+
+sample_slot_t *sample_arena_acquire(void) {
+  for (int i = 0; i < CONFIG_SAMPLE_ARENA_SLOTS; i++) {
+    // Whoever flips in_use from false owns the slot
+    if (!atomic_exchange_explicit(&s_slots[i].in_use, true, memory_order_acquire)) {
+      s_slots[i].len = 0;
+      return &s_slots[i];
+    }
+  }
+  return NULL;
+}
+
+void sample_arena_encode(sample_slot_t *slot) {
+  int len = snprintf(slot->payload, sizeof(slot->payload), "{\"entropy\": %" PRIu64 "}", slot->entropy);
+  slot->len = len < (int)sizeof(slot->payload) ? len : sizeof(slot->payload) - 1;
+}
+
+int sample_arena_encode_batch(sample_slot_t *const *slots, int count, int64_t now_us, char *buf, size_t size) {
+  size_t len = 0;
+  for (int i = 0; i < count && len < size; i++) {
+    len += snprintf(buf + len, size - len, "%c{\"entropy\": %" PRIu64 ", \"age_ms\": %lu}", i == 0 ? '[' : ',',
+                    slots[i]->entropy, (unsigned long)((now_us - slots[i]->timestamp_us) / 1000));
+  }
+  if (len + 1 >= size) {
+    return -1;
+  }
+  buf[len++] = ']';
+  buf[len] = '\0';
+  return len;
+}
+
+void sample_arena_release(sample_slot_t *slot) {
+  atomic_store_explicit(&slot->in_use, false, memory_order_release);
+}
+
+int sample_arena_in_use(void) {
+  int used = 0;
+  for (int i = 0; i < CONFIG_SAMPLE_ARENA_SLOTS; i++) {
+    used += atomic_load_explicit(&s_slots[i].in_use, memory_order_relaxed);
+  }
+  return used;
+}
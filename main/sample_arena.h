@@ -0,0 +1,55 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed pool of sample records. A payload is encoded straight into its slot
+// and handed to the MQTT client from there, never copied into a buffer of
+// our own. Slots are claimed and freed lock-free, from any task.
+
+#define SAMPLE_PAYLOAD_MAX      CONFIG_SAMPLE_PAYLOAD_MAX
+// One sample in a batch, with its separator
+#define SAMPLE_BATCH_ENTRY_MAX  64
+
+typedef struct {
+  uint64_t entropy;
+  int64_t timestamp_us;                 // esp_timer time of generation
+  uint32_t seq;                         // Generation order since boot
+  uint16_t len;                         // Encoded payload length
+  atomic_bool in_use;
+  char payload[SAMPLE_PAYLOAD_MAX];
+} sample_slot_t;
+
+// Returns NULL when every slot is taken
+sample_slot_t *sample_arena_acquire(void);
+
+// Encode the slot's sample as JSON into its payload
+void sample_arena_encode(sample_slot_t *slot);
+
+// Encode samples as a JSON array into buf, each with its age at now_us so
+// the generation times can be recovered. Returns the length, or -1 if buf
+// is too small.
+int sample_arena_encode_batch(sample_slot_t *const *slots, int count, int64_t now_us, char *buf, size_t size);
+
+void sample_arena_release(sample_slot_t *slot);
+
+// Slots taken right now: generating, waiting or being published
+int sample_arena_in_use(void);
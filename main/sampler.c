@@ -0,0 +1,144 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#ifdef CONFIG_ENTROPY_CONDITIONING
+#include "mbedtls/sha256.h"
+#endif
+
+#include "connectivity.h"
+#include "dlog.h"
+#include "entropy_health.h"
+#include "sampler.h"
+#include "spsc_ring.h"
+#include "task_table.h"
+#include "telemetry.h"
+
+// Raw bytes per sample: conditioning compresses 256 bits into 64
+#ifdef CONFIG_ENTROPY_CONDITIONING
+#define RAW_BYTES               32
+#else
+#define RAW_BYTES               sizeof(uint64_t)
+#endif
+
+static spsc_ring_t s_ready;
+static TaskHandle_t s_task;
+static uint32_t s_seq;
+
+static const char *TAG = "FOSSOR";
+
+#ifdef CONFIG_LOCAL_SERVER
+// The local server generates in its own task. The health tests keep state
+// across calls, so they must see the raw bytes of both one at a time.
+static portMUX_TYPE s_raw_lock = portMUX_INITIALIZER_UNLOCKED;
+#define RAW_LOCK()              taskENTER_CRITICAL(&s_raw_lock)
+#define RAW_UNLOCK()            taskEXIT_CRITICAL(&s_raw_lock)
+#else
+#define RAW_LOCK()
+#define RAW_UNLOCK()
+#endif
+
+// One 64-bit value: raw bytes, health tests, optional conditioning
+static bool sampler_generate(uint64_t *entropy) {
+  uint8_t raw[RAW_BYTES];
+  RAW_LOCK();
+  esp_fill_random(raw, sizeof(raw));
+  bool healthy = entropy_health_feed(raw, sizeof(raw));
+  RAW_UNLOCK();
+  if (!healthy) {
+    ESP_LOGE(TAG, "ENTROPY FAILED HEALTH TEST [status=0x%" PRIx32 "]", entropy_health_status());
+    return false;
+  }
+
+  #ifdef CONFIG_ENTROPY_CONDITIONING
+    uint8_t digest[32];
+    mbedtls_sha256(raw, sizeof(raw), digest, 0);
+    memcpy(entropy, digest, sizeof(*entropy));
+  #else
+    memcpy(entropy, raw, sizeof(*entropy));
+  #endif
+  return true;
+}
+
+sample_slot_t *sampler_produce(void) {
+  sample_slot_t *slot = sample_arena_acquire();
+  if (slot == NULL) {
+    // Samples waiting for the broker hold every slot
+    ESP_LOGE(TAG, "SAMPLE ARENA FULL");
+    telemetry_count(TELEM_SAMPLE_DROPPED);
+    return NULL;
+  }
+  slot->timestamp_us = esp_timer_get_time();
+  slot->seq = s_seq++;
+
+  if (!sampler_generate(&slot->entropy)) {
+    sample_arena_release(slot);
+    return NULL;
+  }
+
+  // Create JSON payload in place
+  sample_arena_encode(slot);
+  return slot;
+}
+
+bool sampler_fill(uint8_t *buf, size_t len) {
+  while (len > 0) {
+    uint64_t entropy;
+    if (!sampler_generate(&entropy)) {
+      return false;
+    }
+    size_t n = len < sizeof(entropy) ? len : sizeof(entropy);
+    memcpy(buf, &entropy, n);
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+void sampler_start(void) {
+  s_task = app_task_start(APP_TASK_SAMPLER, NULL);
+}
+
+void sampler_request(void) {
+  xTaskNotifyGive(s_task);
+}
+
+sample_slot_t *sampler_take(void) {
+  return spsc_ring_pop(&s_ready);
+}
+
+void sampler_task(void *pvParameters) {
+  while (1) {
+    uint32_t requests = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while (requests-- > 0) {
+      sample_slot_t *slot = sampler_produce();
+      if (slot != NULL && !spsc_ring_push(&s_ready, slot)) {
+        sample_arena_release(slot);
+        slot = NULL;
+      }
+      if (slot != NULL) {
+        APP_LOG(DLOG_GENERATED);
+      }
+      connectivity_post(CONN_EV_SAMPLE_READY, slot != NULL);
+    }
+  }
+}
@@ -0,0 +1,46 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sample_arena.h"
+
+// Sample pipeline: entropy, health tests, optional conditioning and payload
+// encoding, in its own task (pinned to APP_CPU on dual-core chips). Ready
+// samples reach the connectivity task through an SPSC ring, announced with
+// CONN_EV_SAMPLE_READY.
+
+// Create the sampler task
+void sampler_start(void);
+
+// Ask for one sample. Called by the connectivity task.
+void sampler_request(void);
+
+// Oldest ready sample, NULL if none. Called by the connectivity task.
+sample_slot_t *sampler_take(void);
+
+// Produce one sample in the calling task, NULL on failure
+sample_slot_t *sampler_produce(void);
+
+// Fill buf with entropy from the same pipeline as samples, in the calling
+// task. False if the health tests fail.
+bool sampler_fill(uint8_t *buf, size_t len);
+
+// Task body, listed in the task table
+void sampler_task(void *pvParameters);
@@ -0,0 +1,84 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Simulated link for the linux target: the host's own network stands in
+// for Wi-Fi. The link comes up SIM_LINK_UP_MS after start and, if
+// SIM_LINK_DROP_EVERY is set, drops after every Nth acknowledged publish so
+// the reconnect path runs too.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+
+#include "net_link.h"
+#include "phase_trace.h"
+
+#define SIM_RSSI                -50
+
+static TimerHandle_t s_up_timer;
+static StaticTimer_t s_up_timer_buffer;
+static uint32_t s_publishes;
+
+static const char *TAG = "FOSSOR";
+
+static void link_up(TimerHandle_t timer)
+{
+  phase_trace_mark(PHASE_ASSOCIATED);
+  connectivity_post(CONN_EV_ASSOCIATED, 0);
+  phase_trace_mark(PHASE_GOT_IP);
+  connectivity_post(CONN_EV_GOT_IP, 0);
+}
+
+static void schedule_link_up(void)
+{
+  if (CONFIG_SIM_LINK_UP_MS == 0) {
+    link_up(NULL);
+  } else {
+    xTimerStart(s_up_timer, 0);
+  }
+}
+
+int net_link_rssi(void)
+{
+  return SIM_RSSI;
+}
+
+void net_link_handle(const conn_event_t *event)
+{
+  switch (event->id) {
+    case CONN_EV_DISCONNECTED:
+      phase_trace_mark(PHASE_LINK_START);
+      schedule_link_up();
+      break;
+    case CONN_EV_MQTT_PUBLISHED:
+      if (CONFIG_SIM_LINK_DROP_EVERY > 0 && ++s_publishes % CONFIG_SIM_LINK_DROP_EVERY == 0) {
+        ESP_LOGI(TAG, "SIMULATED LINK DROP");
+        connectivity_post(CONN_EV_DISCONNECTED, 0);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void net_link_start(void)
+{
+  s_up_timer = xTimerCreateStatic("sim_link", pdMS_TO_TICKS(CONFIG_SIM_LINK_UP_MS) + 1, pdFALSE, NULL,
+                                  link_up, &s_up_timer_buffer);
+  ESP_LOGI(TAG, "Starting simulated link");
+  phase_trace_mark(PHASE_LINK_START);
+  schedule_link_up();
+}
@@ -0,0 +1,112 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <malloc.h>
+#else
+#include "esp_heap_caps.h"
+#endif
+
+#include "soak.h"
+
+#ifdef CONFIG_SOAK_TEST
+
+// Otherwise the baseline is never taken and the drift check passes
+_Static_assert(CONFIG_SOAK_WARMUP_CYCLES < CONFIG_SOAK_CYCLES, "SOAK_WARMUP_CYCLES must be below SOAK_CYCLES");
+
+typedef struct {
+  size_t free;
+  size_t largest;
+  size_t min_free;
+} heap_sample_t;
+
+static uint32_t s_cycles;
+static uint32_t s_failures;
+static heap_sample_t s_baseline;
+
+static const char *TAG = "FOSSOR";
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+
+// No heap_caps on the host. glibc's in-use bytes, taken off a fixed budget,
+// drift the same way free heap does on the chip.
+#define HOST_HEAP_BUDGET        (256u << 20)
+
+static size_t s_host_min_free = SIZE_MAX;
+
+static heap_sample_t heap_sample(void) {
+  struct mallinfo2 mi = mallinfo2();
+  size_t free = HOST_HEAP_BUDGET - mi.uordblks;
+  if (free < s_host_min_free) {
+    s_host_min_free = free;
+  }
+  return (heap_sample_t){ .free = free, .largest = free, .min_free = s_host_min_free };
+}
+
+#else
+
+static heap_sample_t heap_sample(void) {
+  return (heap_sample_t){
+    .free = heap_caps_get_free_size(MALLOC_CAP_8BIT),
+    .largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+    .min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+  };
+}
+
+#endif
+
+// Positive when the heap lost bytes since the baseline
+static long drift(size_t baseline, size_t now) {
+  return (long)baseline - (long)now;
+}
+
+bool soak_cycle_done(bool published) {
+  s_cycles++;
+  if (!published) {
+    s_failures++;
+  }
+
+  heap_sample_t h = heap_sample();
+  ESP_LOGI(TAG, "SOAK %" PRIu32 " free=%zu largest=%zu min=%zu failures=%" PRIu32, s_cycles, h.free, h.largest,
+           h.min_free, s_failures);
+
+  // Wi-Fi/lwIP/TLS caches settle during the first cycles
+  if (s_cycles == CONFIG_SOAK_WARMUP_CYCLES) {
+    s_baseline = h;
+  }
+  if (s_cycles < CONFIG_SOAK_CYCLES) {
+    return true;
+  }
+
+  long free_drift = drift(s_baseline.free, h.free);
+  long largest_drift = drift(s_baseline.largest, h.largest);
+  long min_drift = drift(s_baseline.min_free, h.min_free);
+  ESP_LOGI(TAG, "SOAK DRIFT free=%ld largest=%ld min=%ld (limit %d)", free_drift, largest_drift,
+           min_drift, CONFIG_SOAK_MAX_DRIFT_BYTES);
+  if (free_drift > CONFIG_SOAK_MAX_DRIFT_BYTES || largest_drift > CONFIG_SOAK_MAX_DRIFT_BYTES ||
+      min_drift > CONFIG_SOAK_MAX_DRIFT_BYTES) {
+    ESP_LOGE(TAG, "SOAK FAILED");
+    abort();
+  }
+  ESP_LOGI(TAG, "SOAK PASSED [%" PRIu32 " cycles, %" PRIu32 " failed publishes]", s_cycles, s_failures);
+  return false;
+}
+
+#endif
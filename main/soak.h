@@ -0,0 +1,33 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+// Heap soak test: many accelerated publish cycles, heap sampled after each.
+
+#ifdef CONFIG_SOAK_TEST
+
+// Record heap state after a publish cycle. Returns false once the run is
+// over; aborts if free heap, largest block or the low-water mark drifted.
+bool soak_cycle_done(bool published);
+
+#else
+
+static inline bool soak_cycle_done(bool published) { return true; }
+
+#endif
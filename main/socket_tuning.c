@@ -0,0 +1,86 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+#include "broker_store.h"
+#include "socket_tuning.h"
+
+static struct sockaddr_in s_peer;       // sin_family is 0 if unknown
+static const int s_on = 1;
+
+static const char *TAG = "FOSSOR";
+
+void socket_tuning_set_peer(const char *uri, uint32_t port) {
+  char host[BROKER_URI_MAX];
+  uint16_t peer_port;
+  memset(&s_peer, 0, sizeof(s_peer));
+  if (broker_uri_address(uri, port, host, sizeof(host), &peer_port) &&
+      inet_pton(AF_INET, host, &s_peer.sin_addr) == 1) {
+    s_peer.sin_family = AF_INET;
+    s_peer.sin_port = htons(peer_port);
+  }
+}
+
+static int socket_tuning_find(void) {
+  if (s_peer.sin_family != AF_INET) {
+    return -1;
+  }
+  for (int fd = LWIP_SOCKET_OFFSET; fd < LWIP_SOCKET_OFFSET + CONFIG_LWIP_MAX_SOCKETS; fd++) {
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(fd, (struct sockaddr *)&peer, &len) == 0 && peer.sin_family == AF_INET &&
+        peer.sin_port == s_peer.sin_port && peer.sin_addr.s_addr == s_peer.sin_addr.s_addr) {
+      return fd;
+    }
+  }
+  return -1;
+}
+
+void socket_tuning_apply(void) {
+  int fd = socket_tuning_find();
+  if (fd < 0) {
+    ESP_LOGW(TAG, "MQTT SOCKET NOT FOUND");
+    return;
+  }
+  int err = 0;
+  #ifdef CONFIG_MQTT_TCP_NODELAY
+    // The sample and telemetry go out back to back, then the session
+    // closes: nothing is gained by holding the second one for an ACK
+    err |= setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &s_on, sizeof(s_on));
+  #endif
+  #ifdef CONFIG_MQTT_TCP_KEEPALIVE
+    int idle = CONFIG_MQTT_TCP_KEEPALIVE_IDLE_S;
+    int interval = CONFIG_MQTT_TCP_KEEPALIVE_INTERVAL_S;
+    int count = CONFIG_MQTT_TCP_KEEPALIVE_COUNT;
+    err |= setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &s_on, sizeof(s_on));
+    err |= setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    err |= setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    err |= setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+  #endif
+  #ifdef CONFIG_MQTT_SOCKET_LINGER_S
+    // Bound the close, which otherwise leaves lwIP to finish it while the
+    // next session may already be starting
+    struct linger linger = { .l_onoff = 1, .l_linger = CONFIG_MQTT_SOCKET_LINGER_S };
+    err |= setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  #endif
+  if (err != 0) {
+    ESP_LOGW(TAG, "MQTT SOCKET OPTIONS NOT SET [errno=%d]", errno);
+  }
+}
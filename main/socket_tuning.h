@@ -0,0 +1,39 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Socket options for the MQTT session. esp-mqtt keeps its transport to
+// itself, so the session's socket is found by its peer address.
+
+#ifdef CONFIG_MQTT_SOCKET_TUNING
+
+// Remember the broker address of the session about to start. uri has its
+// host already resolved; port 0 takes the port from the URI.
+void socket_tuning_set_peer(const char *uri, uint32_t port);
+
+// Apply the configured options to the socket connected to the broker.
+// Runs in the MQTT task on CONNACK, before anything is published.
+void socket_tuning_apply(void);
+
+#else
+
+static inline void socket_tuning_set_peer(const char *uri, uint32_t port) {}
+static inline void socket_tuning_apply(void) {}
+
+#endif
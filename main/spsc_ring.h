@@ -0,0 +1,57 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free single-producer/single-consumer ring of pointers. One task
+// pushes, one task pops; each only writes its own index, so the two can
+// run on different cores without a lock.
+
+#define SPSC_RING_SIZE          32      // Power of two, >= SAMPLE_ARENA_SLOTS
+
+typedef struct {
+  _Atomic uint32_t head;                // Next slot to write, producer only
+  _Atomic uint32_t tail;                // Next slot to read, consumer only
+  void *items[SPSC_RING_SIZE];
+} spsc_ring_t;
+
+static inline bool spsc_ring_push(spsc_ring_t *ring, void *item) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail == SPSC_RING_SIZE) {
+    return false;
+  }
+  ring->items[head & (SPSC_RING_SIZE - 1)] = item;
+  // Publish the item before the index that makes it visible
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return true;
+}
+
+static inline void *spsc_ring_pop(spsc_ring_t *ring) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (head == tail) {
+    return NULL;
+  }
+  void *item = ring->items[tail & (SPSC_RING_SIZE - 1)];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return item;
+}
@@ -0,0 +1,206 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// esp-mqtt outbox (MQTT_CUSTOM_OUTBOX) backed by static storage. The stock
+// outbox mallocs a copy of every QoS>0 message; this one keeps them in a
+// fixed number of fixed-size items, so a publish never touches the heap.
+// esp-mqtt calls it with the client lock held.
+
+#include <string.h>
+#include "esp_log.h"
+#include "mqtt_outbox.h"
+
+struct outbox_item {
+  bool used;
+  uint16_t msg_id;
+  int msg_type;
+  int msg_qos;
+  outbox_tick_t tick;
+  pending_state_t pending;
+  uint32_t seq;                         // Enqueue order, oldest first
+  size_t len;
+  uint8_t data[CONFIG_STATIC_OUTBOX_ITEM_SIZE];
+};
+
+struct outbox_t {
+  struct outbox_item items[CONFIG_STATIC_OUTBOX_SLOTS];
+  uint32_t seq;
+  bool in_use;
+};
+
+// Only one client exists at a time
+static struct outbox_t s_outbox;
+
+static const char *TAG = "FOSSOR";
+
+outbox_handle_t outbox_init(void) {
+  if (s_outbox.in_use) {
+    ESP_LOGE(TAG, "OUTBOX ALREADY IN USE");
+    return NULL;
+  }
+  memset(&s_outbox, 0, sizeof(s_outbox));
+  s_outbox.in_use = true;
+  return &s_outbox;
+}
+
+outbox_item_handle_t outbox_enqueue(outbox_handle_t outbox, outbox_message_handle_t message, outbox_tick_t tick) {
+  size_t len = message->len + message->remaining_len;
+  if (len > CONFIG_STATIC_OUTBOX_ITEM_SIZE) {
+    ESP_LOGE(TAG, "OUTBOX ITEM TOO LARGE [%zu]", len);
+    return NULL;
+  }
+  for (int i = 0; i < CONFIG_STATIC_OUTBOX_SLOTS; i++) {
+    outbox_item_handle_t item = &outbox->items[i];
+    if (item->used) {
+      continue;
+    }
+    memcpy(item->data, message->data, message->len);
+    if (message->remaining_data != NULL) {
+      memcpy(item->data + message->len, message->remaining_data, message->remaining_len);
+    }
+    item->len = len;
+    item->msg_id = message->msg_id;
+    item->msg_type = message->msg_type;
+    item->msg_qos = message->msg_qos;
+    item->tick = tick;
+    item->pending = QUEUED;
+    item->seq = outbox->seq++;
+    item->used = true;
+    return item;
+  }
+  ESP_LOGE(TAG, "OUTBOX FULL");
+  return NULL;
+}
+
+outbox_item_handle_t outbox_get(outbox_handle_t outbox, int msg_id) {
+  for (int i = 0; i < CONFIG_STATIC_OUTBOX_SLOTS; i++) {
+    if (outbox->items[i].used && outbox->items[i].msg_id == msg_id) {
+      return &outbox->items[i];
+    }
+  }
+  return NULL;
+}
+
+outbox_item_handle_t outbox_dequeue(outbox_handle_t outbox, pending_state_t pending, outbox_tick_t *tick) {
+  outbox_item_handle_t oldest = NULL;
+  for (int i = 0; i < CONFIG_STATIC_OUTBOX_SLOTS; i++) {
+    outbox_item_handle_t item = &outbox->items[i];
+    if (item->used && item->pending == pending &&
+        (oldest == NULL || (int32_t)(item->seq - oldest->seq) < 0)) {
+      oldest = item;
+    }
+  }
+  if (oldest != NULL && tick != NULL) {
+    *tick = oldest->tick;
+  }
+  return oldest;
+}
+
+uint8_t *outbox_item_get_data(outbox_item_handle_t item, size_t *len, uint16_t *msg_id, int *msg_type, int *qos) {
+  if (item == NULL) {
+    return NULL;
+  }
+  *len = item->len;
+  *msg_id = item->msg_id;
+  *msg_type = item->msg_type;
+  *qos = item->msg_qos;
+  return item->data;
+}
+
+esp_err_t outbox_delete_item(outbox_handle_t outbox, outbox_item_handle_t item) {
+  if (item == NULL || !item->used) {
+    return ESP_FAIL;
+  }
+  item->used = false;
+  return ESP_OK;
+}
+
+esp_err_t outbox_delete(outbox_handle_t outbox, int msg_id, int msg_type) {
+  for (int i = 0; i < CONFIG_STATIC_OUTBOX_SLOTS; i++) {
+    outbox_item_handle_t item = &outbox->items[i];
+    if (item->used && item->msg_id == msg_id && item->msg_type == msg_type) {
+      item->used = false;
+      return ESP_OK;
+    }
+  }
+  return ESP_FAIL;
+}
+
+int outbox_delete_single_expired(outbox_handle_t outbox, outbox_tick_t current_tick, outbox_tick_t timeout) {
+  for (int i = 0; i < CONFIG_STATIC_OUTBOX_SLOTS; i++) {
+    outbox_item_handle_t item = &outbox->items[i];
+    if (item->used && current_tick - item->tick > timeout) {
+      item->used = false;
+      return item->msg_id;
+    }
+  }
+  return -1;
+}
+
+int outbox_delete_expired(outbox_handle_t outbox, outbox_tick_t current_tick, outbox_tick_t timeout) {
+  int deleted = 0;
+  for (int i = 0; i < CONFIG_STATIC_OUTBOX_SLOTS; i++) {
+    outbox_item_handle_t item = &outbox->items[i];
+    if (item->used && current_tick - item->tick > timeout) {
+      item->used = false;
+      deleted++;
+    }
+  }
+  return deleted;
+}
+
+esp_err_t outbox_set_pending(outbox_handle_t outbox, int msg_id, pending_state_t pending) {
+  outbox_item_handle_t item = outbox_get(outbox, msg_id);
+  if (item == NULL) {
+    return ESP_FAIL;
+  }
+  item->pending = pending;
+  return ESP_OK;
+}
+
+pending_state_t outbox_item_get_pending(outbox_item_handle_t item) {
+  return item != NULL ? item->pending : QUEUED;
+}
+
+esp_err_t outbox_set_tick(outbox_handle_t outbox, int msg_id, outbox_tick_t tick) {
+  outbox_item_handle_t item = outbox_get(outbox, msg_id);
+  if (item == NULL) {
+    return ESP_FAIL;
+  }
+  item->tick = tick;
+  return ESP_OK;
+}
+
+uint64_t outbox_get_size(outbox_handle_t outbox) {
+  uint64_t size = 0;
+  for (int i = 0; i < CONFIG_STATIC_OUTBOX_SLOTS; i++) {
+    if (outbox->items[i].used) {
+      size += outbox->items[i].len;
+    }
+  }
+  return size;
+}
+
+void outbox_delete_all_items(outbox_handle_t outbox) {
+  for (int i = 0; i < CONFIG_STATIC_OUTBOX_SLOTS; i++) {
+    outbox->items[i].used = false;
+  }
+}
+
+void outbox_destroy(outbox_handle_t outbox) {
+  outbox_delete_all_items(outbox);
+  outbox->in_use = false;
+}
@@ -0,0 +1,162 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdbool.h>
+#include "esp_log.h"
+#ifdef CONFIG_TASK_STACK_REPORT
+#include "esp_heap_caps.h"
+#endif
+
+#include "connectivity.h"
+#include "ota.h"
+#include "sampler.h"
+#include "task_table.h"
+#include "transport.h"
+
+// Stack sizes are in bytes, as ESP-IDF's FreeRTOS port expects. See the
+// README for how they were chosen and how to re-check them. On the linux
+// target tasks are pthreads, whose Kconfig defaults are far larger.
+#define CONN_TASK_STACK_SIZE    CONFIG_CONN_TASK_STACK_SIZE
+#define SAMPLER_STACK_SIZE      CONFIG_SAMPLER_STACK_SIZE
+#define CONN_TASK_PRIORITY      CONFIG_CONN_TASK_PRIORITY
+#define SAMPLER_PRIORITY        CONFIG_SAMPLER_PRIORITY
+#ifdef CONFIG_OTA_UPDATE
+#define OTA_STACK_SIZE          CONFIG_OTA_STACK_SIZE
+#define OTA_PRIORITY            CONFIG_OTA_PRIORITY
+#endif
+#ifdef CONFIG_TRANSPORT_COAP
+#define COAP_STACK_SIZE         CONFIG_COAP_STACK_SIZE
+#define COAP_PRIORITY           CONFIG_COAP_PRIORITY
+#endif
+
+// Networking on PRO_CPU with the Wi-Fi, lwIP and MQTT tasks, the sample
+// pipeline on APP_CPU
+#ifdef CONFIG_SAMPLER_PINNED
+#define CONN_TASK_CORE          0
+#define SAMPLER_CORE            1
+#else
+#define CONN_TASK_CORE          tskNO_AFFINITY
+#define SAMPLER_CORE            tskNO_AFFINITY
+#endif
+#define OTA_CORE                CONN_TASK_CORE
+#define COAP_CORE               CONN_TASK_CORE
+
+typedef struct {
+  const char *name;
+  TaskFunction_t fn;
+  uint32_t stack_size;
+  UBaseType_t priority;
+  BaseType_t core;
+  StackType_t *stack;
+  StaticTask_t *tcb;
+} app_task_t;
+
+static StackType_t s_conn_stack[CONN_TASK_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t s_conn_tcb;
+static StackType_t s_sampler_stack[SAMPLER_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t s_sampler_tcb;
+#ifdef CONFIG_OTA_UPDATE
+static StackType_t s_ota_stack[OTA_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t s_ota_tcb;
+#endif
+#ifdef CONFIG_TRANSPORT_COAP
+static StackType_t s_coap_stack[COAP_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t s_coap_tcb;
+#endif
+
+static const app_task_t s_tasks[APP_TASK_COUNT] = {
+  [APP_TASK_CONNECTIVITY] = {
+    "conn_task", connectivity_task, CONN_TASK_STACK_SIZE, CONN_TASK_PRIORITY, CONN_TASK_CORE,
+    s_conn_stack, &s_conn_tcb,
+  },
+  [APP_TASK_SAMPLER] = {
+    "sampler", sampler_task, SAMPLER_STACK_SIZE, SAMPLER_PRIORITY, SAMPLER_CORE,
+    s_sampler_stack, &s_sampler_tcb,
+  },
+#ifdef CONFIG_OTA_UPDATE
+  [APP_TASK_OTA] = {
+    "ota", ota_task, OTA_STACK_SIZE, OTA_PRIORITY, OTA_CORE,
+    s_ota_stack, &s_ota_tcb,
+  },
+#endif
+#ifdef CONFIG_TRANSPORT_COAP
+  [APP_TASK_COAP] = {
+    "coap", coap_task, COAP_STACK_SIZE, COAP_PRIORITY, COAP_CORE,
+    s_coap_stack, &s_coap_tcb,
+  },
+#endif
+};
+
+static TaskHandle_t s_handles[APP_TASK_COUNT];
+
+static const char *TAG = "FOSSOR";
+
+TaskHandle_t app_task_start(app_task_id_t id, void *arg) {
+  const app_task_t *t = &s_tasks[id];
+  s_handles[id] = xTaskCreateStaticPinnedToCore(t->fn, t->name, t->stack_size, arg, t->priority,
+                                                t->stack, t->tcb, t->core);
+  return s_handles[id];
+}
+
+#ifdef CONFIG_TASK_STACK_REPORT
+
+// ESP-IDF and esp-mqtt tasks whose stacks are sized through sdkconfig
+static const char *const SYSTEM_TASKS[] = { "sys_evt", "tiT", "wifi", "mqtt_task" };
+
+static size_t s_session_free;
+static bool s_monitoring;
+
+void app_task_session_begin(void) {
+  s_session_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_start();
+  s_monitoring = true;
+}
+
+void app_task_session_end(void) {
+  if (!s_monitoring) {
+    return;
+  }
+  // While monitoring, the minimum is the session's own
+  size_t session_min = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_stop();
+  s_monitoring = false;
+  ESP_LOGI(TAG, "HEAP free=%zu min=%zu session_peak=%zu", heap_caps_get_free_size(MALLOC_CAP_8BIT),
+           heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+           s_session_free > session_min ? s_session_free - session_min : 0);
+}
+
+void app_task_report_main(void) {
+  ESP_LOGI(TAG, "STACK %-10s %5lu/%5lu bytes unused", "main", (unsigned long)uxTaskGetStackHighWaterMark(NULL),
+           (unsigned long)CONFIG_ESP_MAIN_TASK_STACK_SIZE);
+}
+
+void app_task_report_stacks(void) {
+  for (int i = 0; i < APP_TASK_COUNT; i++) {
+    if (s_handles[i] != NULL) {
+      ESP_LOGI(TAG, "STACK %-10s %5lu/%5lu bytes unused", s_tasks[i].name,
+               (unsigned long)uxTaskGetStackHighWaterMark(s_handles[i]), (unsigned long)s_tasks[i].stack_size);
+    }
+  }
+  for (int i = 0; i < sizeof(SYSTEM_TASKS) / sizeof(SYSTEM_TASKS[0]); i++) {
+    TaskHandle_t handle = xTaskGetHandle(SYSTEM_TASKS[i]);
+    if (handle != NULL) {
+      ESP_LOGI(TAG, "STACK %-10s %5lu bytes unused", SYSTEM_TASKS[i],
+               (unsigned long)uxTaskGetStackHighWaterMark(handle));
+    }
+  }
+}
+
+#endif
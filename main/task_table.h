@@ -0,0 +1,53 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Every application task, created from a static table in task_table.c
+typedef enum {
+  APP_TASK_CONNECTIVITY,
+  APP_TASK_SAMPLER,
+#ifdef CONFIG_OTA_UPDATE
+  APP_TASK_OTA,
+#endif
+#ifdef CONFIG_TRANSPORT_COAP
+  APP_TASK_COAP,
+#endif
+  APP_TASK_COUNT
+} app_task_id_t;
+
+// Create a task with its statically allocated stack and TCB
+TaskHandle_t app_task_start(app_task_id_t id, void *arg);
+
+#ifdef CONFIG_TASK_STACK_REPORT
+// Start tracking the lowest free heap of an MQTT session
+void app_task_session_begin(void);
+// Stop tracking and log the heap the session took at its peak, whether or
+// not it published
+void app_task_session_end(void);
+// Log the stack high-water mark of the main task, before app_main returns
+void app_task_report_main(void);
+// Log the stack high-water mark of application and system tasks
+void app_task_report_stacks(void);
+#else
+static inline void app_task_session_begin(void) {}
+static inline void app_task_session_end(void) {}
+static inline void app_task_report_main(void) {}
+static inline void app_task_report_stacks(void) {}
+#endif
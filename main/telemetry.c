@@ -0,0 +1,94 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+#include "esp_timer.h"
+
+#include "entropy_health.h"
+#include "ota.h"
+#include "phase_trace.h"
+#include "telemetry.h"
+
+#ifdef CONFIG_TELEMETRY
+
+static uint32_t s_counters[TELEM_COUNTER_COUNT];
+static uint32_t s_reports_since_record;
+static char s_record[TELEMETRY_RECORD_MAX];
+
+void telemetry_count(telemetry_counter_t counter) {
+  s_counters[counter]++;
+}
+
+const char *telemetry_record(int rssi, int *len_out) {
+  if (++s_reports_since_record < CONFIG_TELEMETRY_INTERVAL) {
+    return NULL;
+  }
+  s_reports_since_record = 0;
+
+  char *buf = s_record;
+  size_t size = sizeof(s_record);
+  #ifdef CONFIG_IDF_TARGET_LINUX
+    unsigned heap_min = 0;
+  #else
+    unsigned heap_min = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  #endif
+
+  // Counters are totals since boot, so a lost record loses nothing
+  int len = snprintf(buf, size,
+                     "{\"up\":%" PRId64 ",\"ok\":%" PRIu32 ",\"fail\":%" PRIu32 ",\"drop\":%" PRIu32 ","
+                     "\"rc\":[%" PRIu32 ",%" PRIu32 "],\"rssi\":%d,"
+                     "\"heap_min\":%u,\"health\":[%" PRIu32 ",%" PRIu32 "]",
+                     esp_timer_get_time() / 1000000, s_counters[TELEM_PUBLISH_OK],
+                     s_counters[TELEM_PUBLISH_FAILED], s_counters[TELEM_SAMPLE_DROPPED],
+                     s_counters[TELEM_RECONNECT_LINK],
+                     s_counters[TELEM_RECONNECT_SESSION], rssi,
+                     heap_min,
+                     entropy_health_status(), entropy_health_failures());
+
+  // Update that installed this image: [downloaded, image, ms]
+  ota_stats_t ota;
+  if (ota_last_update(&ota) && len < (int)size) {
+    len += snprintf(buf + len, size - len, ",\"ota\":[%" PRIu32 ",%" PRIu32 ",%" PRIu32 "]", ota.downloaded, ota.image_size,
+                    ota.apply_ms);
+  }
+
+  // Per-phase [n, p50, p95, p99] in milliseconds
+  bool any = false;
+  for (int p = 0; p < PHASE_COUNT && len < (int)size; p++) {
+    uint32_t n, pct[3];
+    if (phase_trace_percentiles(p, &n, pct)) {
+      len += snprintf(buf + len, size - len, "%s\"%s\":[%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "]", any ? "," : ",\"lat\":{",
+                      phase_trace_name(p), n, pct[0] / 1000, pct[1] / 1000, pct[2] / 1000);
+      any = true;
+    }
+  }
+  if (len < (int)size) {
+    len += snprintf(buf + len, size - len, any ? "}}" : "}");
+  }
+  // Truncated records are not worth sending
+  if (len >= (int)size) {
+    return NULL;
+  }
+  *len_out = len;
+  return s_record;
+}
+
+#endif
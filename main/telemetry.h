@@ -0,0 +1,48 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#define TELEMETRY_RECORD_MAX    512
+
+// Operational counters, published as a compact JSON record on a separate
+// topic every CONFIG_TELEMETRY_INTERVAL acknowledged samples.
+
+typedef enum {
+  TELEM_PUBLISH_OK,
+  TELEM_PUBLISH_FAILED,
+  TELEM_RECONNECT_LINK,         // Wi-Fi/Ethernet link lost
+  TELEM_RECONNECT_SESSION,      // MQTT session lost or failed before PUBACK
+  TELEM_SAMPLE_DROPPED,         // Arena full of unpublished samples
+  TELEM_COUNTER_COUNT
+} telemetry_counter_t;
+
+#ifdef CONFIG_TELEMETRY
+
+void telemetry_count(telemetry_counter_t counter);
+
+// Encode a record if one is due after this report. Returns it, or NULL if
+// none is due. Valid until the next call.
+const char *telemetry_record(int rssi, int *len);
+
+#else
+
+static inline void telemetry_count(telemetry_counter_t counter) {}
+static inline const char *telemetry_record(int rssi, int *len) { return NULL; }
+
+#endif
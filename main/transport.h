@@ -0,0 +1,62 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Publish transport below the connectivity task: MQTT over TLS
+// (transport_mqtt.c), or CoAP over DTLS (transport_coap.c), chosen with
+// CONFIG_TRANSPORT. Either one reports a session through the
+// CONN_EV_MQTT_* events, tagged with the session number as their argument.
+
+// Version of the JSON payloads, sent along where the transport can carry
+// it. Raise it when a payload format changes.
+#define PAYLOAD_FORMAT_VERSION  "1"
+
+// Most bytes a publish adds to its topic and payload: fixed header, topic
+// length and packet ID, and with MQTT 5 the property length, topic alias
+// and the format and seq user properties. Sizes the static outbox.
+#ifdef CONFIG_MQTT_V5
+#define TRANSPORT_PUBLISH_OVERHEAD  (9 + 4 + 3 + (5 + 6 + sizeof(PAYLOAD_FORMAT_VERSION) - 1) + (5 + 3 + 11))
+#else
+#define TRANSPORT_PUBLISH_OVERHEAD  9
+#endif
+
+// One-time set-up that can overlap with bringing the link up, such as
+// parsing certificates. Runs in the connectivity task before anything else.
+void transport_prepare(void);
+
+// Open a session to uri, whose host is already resolved to an address.
+// port 0 takes the port from the URI. host is the server's name for
+// certificate checks, empty if the URI was not resolved. CONNECTED
+// follows, or ERROR.
+bool transport_session_start(const char *uri, uint32_t port, const char *host, uint32_t session);
+
+// Close the session. Events it had not yet reported are dropped.
+void transport_session_stop(void);
+
+// Publish on an open session. QoS 1 is confirmed with PUBLISHED, QoS 0 is
+// not confirmed. seq is the sequence number of the (first) sample in the
+// payload, negative if it carries none. Returns the message ID, negative
+// on failure.
+int transport_publish(const char *topic, const char *data, int len, int qos, int64_t seq);
+
+#ifdef CONFIG_TRANSPORT_COAP
+// Task body, listed in the task table
+void coap_task(void *pvParameters);
+#endif
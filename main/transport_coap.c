@@ -0,0 +1,521 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// CoAP (RFC 7252) over DTLS 1.2. The association outlives a session: the
+// next sample goes out on it without a handshake, in one round trip. With
+// the connection ID extension the server still finds the association after
+// the device's address or NAT mapping changes.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+
+#include "broker_store.h"
+#include "connectivity.h"
+#include "device_certs.h"
+#include "phase_trace.h"
+#include "task_table.h"
+#include "telemetry.h"
+#include "transport.h"
+
+#define COAP_VERSION            1
+#define COAP_TYPE_CON           0
+#define COAP_TYPE_NON           1
+#define COAP_TYPE_ACK           2
+#define COAP_TYPE_RST           3
+#define COAP_CODE_POST          0x02
+#define COAP_OPTION_URI_PATH    11
+#define COAP_OPTION_FORMAT      12
+#define COAP_FORMAT_JSON        50
+#define COAP_MSG_MAX            (TELEMETRY_RECORD_MAX + 64)
+
+#define COAP_QUEUE_LENGTH       4
+#define COAP_POLL_MS            50      // Read timeout while a message is unacknowledged
+#define COAP_MTU                1280    // Largest datagram, handshake included
+#define COAP_HANDSHAKE_MIN_MS   1000    // DTLS retransmission timer, doubling up to the max
+#define COAP_HANDSHAKE_MAX_MS   16000
+
+typedef enum {
+  COAP_CMD_START,
+  COAP_CMD_PUBLISH,
+  COAP_CMD_STOP,
+} coap_cmd_id_t;
+
+// From the connectivity task to the CoAP task
+typedef struct {
+  coap_cmd_id_t id;
+  uint32_t session;
+  union {
+    struct {
+      char uri[BROKER_URI_MAX];
+      char host[BROKER_URI_MAX];
+      uint32_t port;
+    } start;
+    struct {
+      bool confirmable;
+      uint16_t len;
+      uint8_t msg[COAP_MSG_MAX];
+    } publish;
+  };
+} coap_cmd_t;
+
+// Traffic of one session, handshake included, logged when it stops
+typedef struct {
+  uint32_t tx_bytes;
+  uint32_t tx_datagrams;
+  uint32_t rx_bytes;
+  uint32_t rx_datagrams;
+} coap_stats_t;
+
+static QueueHandle_t s_cmds;
+static StaticQueue_t s_cmds_buffer;
+static uint8_t s_cmds_storage[COAP_QUEUE_LENGTH * sizeof(coap_cmd_t)];
+// Connectivity task side
+static coap_cmd_t s_next_cmd;           // Built here, copied into the queue
+static uint32_t s_next_session;
+static uint16_t s_next_mid;
+
+// Everything below belongs to the CoAP task
+static mbedtls_x509_crt s_ca;
+static mbedtls_x509_crt s_cert;
+static mbedtls_pk_context s_key;
+static mbedtls_ssl_config s_conf;
+static mbedtls_ssl_session s_saved;     // For an abbreviated handshake next time
+static bool s_saved_valid;
+
+static int s_fd = -1;                   // -1 without an association
+static mbedtls_ssl_context s_ssl;
+static char s_assoc_uri[BROKER_URI_MAX];
+static uint32_t s_assoc_port;
+static int64_t s_used_us;               // Last exchange on the association
+static int64_t s_timer_int_us;          // DTLS handshake timer
+static int64_t s_timer_fin_us;
+
+static bool s_open;
+static uint32_t s_session;
+static coap_stats_t s_stats;
+
+// The unacknowledged confirmable message, if any. Connectivity publishes
+// one sample at a time.
+static bool s_pending;
+static uint8_t s_pending_msg[COAP_MSG_MAX];
+static uint16_t s_pending_len;
+static int s_retransmits;
+static uint32_t s_timeout_ms;
+static int64_t s_deadline_us;
+static uint8_t s_rx[COAP_MSG_MAX];
+
+static const char *TAG = "FOSSOR";
+
+static int coap_random(void *ctx, unsigned char *buf, size_t len) {
+  esp_fill_random(buf, len);
+  return 0;
+}
+
+static int coap_send(void *ctx, const unsigned char *buf, size_t len) {
+  int ret = send(s_fd, buf, len, 0);
+  if (ret < 0) {
+    return MBEDTLS_ERR_NET_SEND_FAILED;
+  }
+  s_stats.tx_bytes += ret;
+  s_stats.tx_datagrams++;
+  return ret;
+}
+
+static int coap_recv(void *ctx, unsigned char *buf, size_t len, uint32_t timeout_ms) {
+  fd_set readable;
+  FD_ZERO(&readable);
+  FD_SET(s_fd, &readable);
+  struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+  int ret = select(s_fd + 1, &readable, NULL, NULL, timeout_ms > 0 ? &timeout : NULL);
+  if (ret == 0) {
+    return MBEDTLS_ERR_SSL_TIMEOUT;
+  }
+  ret = ret < 0 ? ret : recv(s_fd, buf, len, 0);
+  if (ret < 0) {
+    return MBEDTLS_ERR_NET_RECV_FAILED;
+  }
+  s_stats.rx_bytes += ret;
+  s_stats.rx_datagrams++;
+  return ret;
+}
+
+static void coap_timer_set(void *ctx, uint32_t int_ms, uint32_t fin_ms) {
+  int64_t now_us = esp_timer_get_time();
+  s_timer_int_us = now_us + int_ms * 1000LL;
+  s_timer_fin_us = fin_ms == 0 ? 0 : now_us + fin_ms * 1000LL;
+}
+
+static int coap_timer_get(void *ctx) {
+  if (s_timer_fin_us == 0) {
+    return -1;
+  }
+  int64_t now_us = esp_timer_get_time();
+  return now_us >= s_timer_fin_us ? 2 : now_us >= s_timer_int_us ? 1 : 0;
+}
+
+static void coap_close(bool notify) {
+  if (s_fd < 0) {
+    return;
+  }
+  if (notify) {
+    mbedtls_ssl_close_notify(&s_ssl);
+  }
+  mbedtls_ssl_free(&s_ssl);
+  close(s_fd);
+  s_fd = -1;
+  s_pending = false;
+}
+
+// DTLS handshake with the server of uri. Blocks until done or timed out.
+static bool coap_associate(const char *uri, uint32_t port, const char *host) {
+  char addr_text[BROKER_URI_MAX];
+  uint16_t peer_port;
+  struct sockaddr_in peer = { .sin_family = AF_INET };
+  if (!broker_uri_address(uri, port, addr_text, sizeof(addr_text), &peer_port) ||
+      inet_pton(AF_INET, addr_text, &peer.sin_addr) != 1) {
+    ESP_LOGE(TAG, "COAP SERVER ADDRESS INVALID [%s]", uri);
+    return false;
+  }
+  peer.sin_port = htons(peer_port);
+  s_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (s_fd < 0) {
+    ESP_LOGE(TAG, "COAP SOCKET NOT CREATED [errno=%d]", errno);
+    return false;
+  }
+
+  mbedtls_ssl_init(&s_ssl);
+  int ret = connect(s_fd, (struct sockaddr *)&peer, sizeof(peer)) == 0 ? 0 : MBEDTLS_ERR_NET_CONNECT_FAILED;
+  if (ret == 0) {
+    ret = mbedtls_ssl_setup(&s_ssl, &s_conf);
+  }
+  if (ret == 0) {
+    // Certificates name the server, not its address
+    ret = mbedtls_ssl_set_hostname(&s_ssl, host[0] != '\0' ? host : addr_text);
+  }
+  #ifdef MBEDTLS_SSL_DTLS_CONNECTION_ID
+    if (ret == 0) {
+      // Ask for the server's CID. The device needs none of its own: its
+      // socket already identifies the server.
+      ret = mbedtls_ssl_set_cid(&s_ssl, MBEDTLS_SSL_CID_ENABLED, NULL, 0);
+    }
+  #endif
+  if (ret == 0 && s_saved_valid && mbedtls_ssl_set_session(&s_ssl, &s_saved) != 0) {
+    s_saved_valid = false;
+  }
+  if (ret == 0) {
+    mbedtls_ssl_set_mtu(&s_ssl, COAP_MTU);
+    mbedtls_ssl_set_bio(&s_ssl, NULL, coap_send, NULL, coap_recv);
+    mbedtls_ssl_set_timer_cb(&s_ssl, NULL, coap_timer_set, coap_timer_get);
+    do {
+      ret = mbedtls_ssl_handshake(&s_ssl);
+    } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+  }
+  if (ret != 0) {
+    ESP_LOGE(TAG, "DTLS HANDSHAKE FAILED [-0x%04x]", -ret);
+    mbedtls_ssl_free(&s_ssl);
+    close(s_fd);
+    s_fd = -1;
+    return false;
+  }
+
+  mbedtls_ssl_session_free(&s_saved);
+  mbedtls_ssl_session_init(&s_saved);
+  s_saved_valid = mbedtls_ssl_get_session(&s_ssl, &s_saved) == 0;
+  snprintf(s_assoc_uri, sizeof(s_assoc_uri), "%s", uri);
+  s_assoc_port = port;
+  return true;
+}
+
+// The association is gone or useless: report the session as failed
+static void coap_fail(void) {
+  coap_close(false);
+  connectivity_post(CONN_EV_MQTT_ERROR, s_session);
+}
+
+static bool coap_write(const uint8_t *msg, size_t len) {
+  int ret;
+  do {
+    ret = mbedtls_ssl_write(&s_ssl, msg, len);
+  } while (ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+  if (ret < 0) {
+    ESP_LOGE(TAG, "COAP NOT SENT [-0x%04x]", -ret);
+    return false;
+  }
+  return true;
+}
+
+static void coap_start(const coap_cmd_t *cmd) {
+  s_open = true;
+  s_session = cmd->session;
+  memset(&s_stats, 0, sizeof(s_stats));
+  int64_t now_us = esp_timer_get_time();
+  // The server has likely dropped an association idle this long, and
+  // finding out costs every retransmission
+  if (s_fd >= 0 && (now_us - s_used_us > CONFIG_COAP_SESSION_IDLE_S * 1000000LL ||
+                    strcmp(s_assoc_uri, cmd->start.uri) != 0 || s_assoc_port != cmd->start.port)) {
+    coap_close(true);
+  }
+  if (s_fd < 0 && !coap_associate(cmd->start.uri, cmd->start.port, cmd->start.host)) {
+    connectivity_post(CONN_EV_MQTT_ERROR, s_session);
+    return;
+  }
+  s_used_us = esp_timer_get_time();
+  phase_trace_mark(PHASE_CONNACK);
+  connectivity_post(CONN_EV_MQTT_CONNECTED, s_session);
+}
+
+static void coap_publish(const coap_cmd_t *cmd) {
+  if (!s_open || cmd->session != s_session || s_fd < 0) {
+    return;
+  }
+  if (!coap_write(cmd->publish.msg, cmd->publish.len)) {
+    coap_fail();
+    return;
+  }
+  if (cmd->publish.confirmable) {
+    memcpy(s_pending_msg, cmd->publish.msg, cmd->publish.len);
+    s_pending_len = cmd->publish.len;
+    s_pending = true;
+    s_retransmits = 0;
+    // ACK_TIMEOUT times a random factor between 1 and ACK_RANDOM_FACTOR (1.5)
+    s_timeout_ms = CONFIG_COAP_ACK_TIMEOUT_MS + esp_random() % (CONFIG_COAP_ACK_TIMEOUT_MS / 2 + 1);
+    s_deadline_us = esp_timer_get_time() + s_timeout_ms * 1000LL;
+  }
+}
+
+static void coap_stop(const coap_cmd_t *cmd) {
+  if (!s_open || cmd->session != s_session) {
+    return;
+  }
+  // The association stays for the next session
+  s_open = false;
+  s_pending = false;
+  ESP_LOGI(TAG, "COAP SESSION [tx=%lu bytes/%lu datagrams rx=%lu bytes/%lu datagrams]",
+           (unsigned long)s_stats.tx_bytes, (unsigned long)s_stats.tx_datagrams,
+           (unsigned long)s_stats.rx_bytes, (unsigned long)s_stats.rx_datagrams);
+}
+
+static void coap_receive(const uint8_t *msg, size_t len) {
+  if (len < 4 || (msg[0] >> 6) != COAP_VERSION) {
+    return;
+  }
+  uint8_t type = (msg[0] >> 4) & 0x3;
+  uint16_t mid = (msg[2] << 8) | msg[3];
+  if (type == COAP_TYPE_CON) {
+    // A separate response to an earlier request: acknowledge and ignore
+    const uint8_t ack[4] = { COAP_VERSION << 6 | COAP_TYPE_ACK << 4, 0, msg[2], msg[3] };
+    coap_write(ack, sizeof(ack));
+    return;
+  }
+  if (!s_pending || mid != ((s_pending_msg[2] << 8) | s_pending_msg[3])) {
+    return;
+  }
+  s_pending = false;
+  s_used_us = esp_timer_get_time();
+  uint8_t code_class = msg[1] >> 5;
+  if (type == COAP_TYPE_ACK && (msg[1] == 0 || code_class == 2)) {
+    // Empty ACK: a separate response follows, but the server has the data
+    phase_trace_mark(PHASE_PUBACK);
+    connectivity_post(CONN_EV_MQTT_PUBLISHED, s_session);
+  } else if (type == COAP_TYPE_ACK) {
+    ESP_LOGE(TAG, "COAP REQUEST REJECTED [%d.%02d]", code_class, msg[1] & 0x1f);
+    connectivity_post(CONN_EV_MQTT_ERROR, s_session);
+  } else if (type == COAP_TYPE_RST) {
+    // The server has no state for the message
+    coap_fail();
+  }
+}
+
+// Read replies and retransmit while a confirmable message is unacknowledged
+static void coap_poll(void) {
+  int ret = mbedtls_ssl_read(&s_ssl, s_rx, sizeof(s_rx));
+  if (ret > 0) {
+    coap_receive(s_rx, ret);
+  } else if (ret != MBEDTLS_ERR_SSL_TIMEOUT && ret != MBEDTLS_ERR_SSL_WANT_READ) {
+    ESP_LOGE(TAG, "DTLS ASSOCIATION LOST [-0x%04x]", -ret);
+    coap_fail();
+    return;
+  }
+
+  if (s_pending && esp_timer_get_time() >= s_deadline_us) {
+    if (++s_retransmits > CONFIG_COAP_MAX_RETRANSMIT) {
+      ESP_LOGE(TAG, "COAP NOT ACKNOWLEDGED");
+      coap_fail();
+    } else if (!coap_write(s_pending_msg, s_pending_len)) {
+      coap_fail();
+    } else {
+      s_timeout_ms *= 2;
+      s_deadline_us = esp_timer_get_time() + s_timeout_ms * 1000LL;
+    }
+  }
+}
+
+void coap_task(void *pvParameters) {
+  coap_cmd_t cmd;
+  while (1) {
+    // Commands first. Only an unacknowledged message needs the socket read.
+    if (xQueueReceive(s_cmds, &cmd, s_pending ? 0 : portMAX_DELAY) == pdTRUE) {
+      switch (cmd.id) {
+        case COAP_CMD_START:
+          coap_start(&cmd);
+          break;
+        case COAP_CMD_PUBLISH:
+          coap_publish(&cmd);
+          break;
+        case COAP_CMD_STOP:
+          coap_stop(&cmd);
+          break;
+      }
+    } else if (s_pending) {
+      coap_poll();
+    }
+  }
+}
+
+void transport_prepare(void) {
+  mbedtls_x509_crt_init(&s_ca);
+  mbedtls_x509_crt_init(&s_cert);
+  mbedtls_pk_init(&s_key);
+  mbedtls_ssl_config_init(&s_conf);
+  mbedtls_ssl_session_init(&s_saved);
+
+  int ret = mbedtls_x509_crt_parse(&s_ca, (const unsigned char *)root_CA_crt, strlen(root_CA_crt) + 1);
+  if (ret == 0) {
+    ret = mbedtls_x509_crt_parse(&s_cert, (const unsigned char *)const_cert_pem, strlen(const_cert_pem) + 1);
+  }
+  if (ret == 0) {
+    ret = mbedtls_pk_parse_key(&s_key, (const unsigned char *)const_private_key, strlen(const_private_key) + 1,
+                               NULL, 0, coap_random, NULL);
+  }
+  if (ret == 0) {
+    ret = mbedtls_ssl_config_defaults(&s_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_DATAGRAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+  }
+  if (ret == 0) {
+    ret = mbedtls_ssl_conf_own_cert(&s_conf, &s_cert, &s_key);
+  }
+  #ifdef MBEDTLS_SSL_DTLS_CONNECTION_ID
+    if (ret == 0) {
+      ret = mbedtls_ssl_conf_cid(&s_conf, 0, MBEDTLS_SSL_UNEXPECTED_CID_IGNORE);
+    }
+  #endif
+  if (ret != 0) {
+    ESP_LOGE(TAG, "DTLS NOT CONFIGURED [-0x%04x]", -ret);
+  }
+  mbedtls_ssl_conf_authmode(&s_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&s_conf, &s_ca, NULL);
+  mbedtls_ssl_conf_rng(&s_conf, coap_random, NULL);
+  mbedtls_ssl_conf_handshake_timeout(&s_conf, COAP_HANDSHAKE_MIN_MS, COAP_HANDSHAKE_MAX_MS);
+  mbedtls_ssl_conf_read_timeout(&s_conf, COAP_POLL_MS);
+
+  s_next_mid = esp_random();
+  s_cmds = xQueueCreateStatic(COAP_QUEUE_LENGTH, sizeof(coap_cmd_t), s_cmds_storage, &s_cmds_buffer);
+  app_task_start(APP_TASK_COAP, NULL);
+}
+
+static bool coap_send_cmd(const coap_cmd_t *cmd) {
+  if (xQueueSend(s_cmds, cmd, 0) != pdTRUE) {
+    ESP_LOGE(TAG, "COAP QUEUE FULL [cmd=%d]", cmd->id);
+    return false;
+  }
+  return true;
+}
+
+bool transport_session_start(const char *uri, uint32_t port, const char *host, uint32_t session) {
+  coap_cmd_t *cmd = &s_next_cmd;
+  s_next_session = session;
+  cmd->id = COAP_CMD_START;
+  cmd->session = session;
+  snprintf(cmd->start.uri, sizeof(cmd->start.uri), "%s", uri);
+  snprintf(cmd->start.host, sizeof(cmd->start.host), "%s", host);
+  cmd->start.port = port;
+  return coap_send_cmd(cmd);
+}
+
+void transport_session_stop(void) {
+  coap_cmd_t *cmd = &s_next_cmd;
+  cmd->id = COAP_CMD_STOP;
+  cmd->session = s_next_session;
+  coap_send_cmd(cmd);
+}
+
+static uint8_t *coap_option(uint8_t *p, uint16_t delta, const void *value, size_t len) {
+  uint8_t delta_field = delta < 13 ? delta : 13;
+  uint8_t len_field = len < 13 ? len : 13;
+  *p++ = delta_field << 4 | len_field;
+  if (delta_field == 13) {
+    *p++ = delta - 13;
+  }
+  if (len_field == 13) {
+    *p++ = len - 13;
+  }
+  memcpy(p, value, len);
+  return p + len;
+}
+
+// POST to the topic as a path, e.g. entropy/zero to /entropy/zero
+int transport_publish(const char *topic, const char *data, int len, int qos, int64_t seq) {
+  coap_cmd_t *cmd = &s_next_cmd;
+  uint8_t *p = cmd->publish.msg;
+  // Header, options of at most two bytes plus their value, payload marker.
+  // A segment under 269 bytes needs no more than one extra length byte.
+  size_t segments = 1;
+  for (const char *c = topic; *c != '\0'; c++) {
+    segments += *c == '/';
+  }
+  size_t topic_len = strlen(topic);
+  if (len < 0 || topic_len > 268 || 4 + topic_len + 2 * segments + 2 + 1 + len > sizeof(cmd->publish.msg)) {
+    return -1;
+  }
+
+  uint16_t mid = s_next_mid++;
+  *p++ = COAP_VERSION << 6 | (qos > 0 ? COAP_TYPE_CON : COAP_TYPE_NON) << 4;
+  *p++ = COAP_CODE_POST;
+  *p++ = mid >> 8;
+  *p++ = mid & 0xff;
+  uint16_t option = 0;
+  for (const char *segment = topic; ; ) {
+    size_t segment_len = strcspn(segment, "/");
+    p = coap_option(p, COAP_OPTION_URI_PATH - option, segment, segment_len);
+    option = COAP_OPTION_URI_PATH;
+    segment += segment_len;
+    if (*segment++ == '\0') {
+      break;
+    }
+  }
+  const uint8_t format = COAP_FORMAT_JSON;
+  p = coap_option(p, COAP_OPTION_FORMAT - option, &format, sizeof(format));
+  if (len > 0) {
+    *p++ = 0xff;
+    memcpy(p, data, len);
+    p += len;
+  }
+
+  cmd->id = COAP_CMD_PUBLISH;
+  cmd->session = s_next_session;
+  cmd->publish.confirmable = qos > 0;
+  cmd->publish.len = p - cmd->publish.msg;
+  return coap_send_cmd(cmd) ? mid : -1;
+}
@@ -0,0 +1,214 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mqtt_client.h"
+#ifdef CONFIG_MQTT_V5
+#include "mqtt5_client.h"
+#endif
+#ifdef CONFIG_FAST_START
+#include "esp_tls.h"
+#endif
+
+#include "connectivity.h"
+#include "device_certs.h"
+#include "phase_trace.h"
+#include "socket_tuning.h"
+#include "transport.h"
+
+static esp_mqtt_client_handle_t client;
+#ifdef CONFIG_FAST_START
+static bool s_ca_store_ready;           // Root CA parsed into the global store
+#endif
+#ifdef CONFIG_MQTT_V5
+#define TOPIC_ALIAS_MAX         4
+// Topics published on this connection. A topic is given alias index + 1
+// the second time it is used, and sent without its name after that, so a
+// topic used once costs nothing extra.
+static struct {
+  const char *topic;
+  bool aliased;                         // The broker knows the alias
+} s_topics[TOPIC_ALIAS_MAX];
+#endif
+
+static const char *TAG = "FOSSOR";
+
+// Runs in the MQTT task: forward to the queue, tagged with the session
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
+  uint32_t session = (uint32_t)(uintptr_t)handler_args;
+  switch (event_id) {
+    case MQTT_EVENT_CONNECTED:
+      phase_trace_mark(PHASE_CONNACK);
+      socket_tuning_apply();
+      connectivity_post(CONN_EV_MQTT_CONNECTED, session);
+      break;
+    case MQTT_EVENT_PUBLISHED:
+      phase_trace_mark(PHASE_PUBACK);
+      connectivity_post(CONN_EV_MQTT_PUBLISHED, session);
+      break;
+    case MQTT_EVENT_DISCONNECTED:
+      connectivity_post(CONN_EV_MQTT_DISCONNECTED, session);
+      break;
+    case MQTT_EVENT_ERROR:
+      connectivity_post(CONN_EV_MQTT_ERROR, session);
+      break;
+  }
+}
+
+void transport_prepare(void) {
+  #ifdef CONFIG_FAST_START
+    // Parse the root CA once instead of for every session
+    esp_err_t err = esp_tls_init_global_ca_store();
+    if (err == ESP_OK) {
+      err = esp_tls_set_global_ca_store((const unsigned char *)root_CA_crt, strlen(root_CA_crt) + 1);
+    }
+    s_ca_store_ready = err == ESP_OK;
+    if (!s_ca_store_ready) {
+      ESP_LOGE(TAG, "CA STORE NOT LOADED [%s]", esp_err_to_name(err));
+    }
+  #endif
+}
+
+bool transport_session_start(const char *uri, uint32_t port, const char *host, uint32_t session) {
+  socket_tuning_set_peer(uri, port);
+
+  // Configure MQTT
+  esp_mqtt_client_config_t mqtt_cfg = {
+    .broker = {
+      .address.uri = uri,
+      .address.port = port,
+      .verification = {
+        .certificate = root_CA_crt,
+      }
+    },
+    .credentials.authentication = {
+      .certificate = const_cert_pem,
+      .key = const_private_key,
+    }
+  };
+  if (host[0] != '\0') {
+    // TLS still checks the certificate, and sends SNI, for the name
+    mqtt_cfg.broker.verification.common_name = host;
+  }
+  #ifdef CONFIG_FAST_START
+    mqtt_cfg.broker.verification.use_global_ca_store = s_ca_store_ready;
+  #endif
+  #ifdef CONFIG_MQTT_V5
+    mqtt_cfg.session.protocol_ver = MQTT_PROTOCOL_V_5;
+    // Ask the broker to resume the previous session rather than start over
+    mqtt_cfg.session.disable_clean_session = CONFIG_MQTT_V5_SESSION_EXPIRY_S > 0;
+  #endif
+
+  // Start MQTT client
+  client = esp_mqtt_client_init(&mqtt_cfg);
+  if (client == NULL) {
+    ESP_LOGE(TAG, "MQTT CLIENT NOT CREATED");
+    return false;
+  }
+  esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, (void *)(uintptr_t)session);
+
+  #ifdef CONFIG_MQTT_V5
+    esp_mqtt5_connection_property_config_t connect_property = {
+      .session_expiry_interval = CONFIG_MQTT_V5_SESSION_EXPIRY_S,
+      .receive_maximum = CONFIG_MQTT_V5_RECEIVE_MAXIMUM,
+    };
+    if (esp_mqtt5_client_set_connect_property(client, &connect_property) != ESP_OK) {
+      ESP_LOGE(TAG, "MQTT5 CONNECT PROPERTIES NOT SET");
+    }
+    // Aliases last as long as the connection
+    memset(s_topics, 0, sizeof(s_topics));
+  #endif
+
+  esp_err_t err = esp_mqtt_client_start(client);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "MQTT CLIENT NOT STARTED");
+    esp_mqtt_client_destroy(client);
+    client = NULL;
+    return false;
+  }
+  return true;
+}
+
+void transport_session_stop(void) {
+  if (client != NULL) {
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    client = NULL;
+  }
+}
+
+#ifdef CONFIG_MQTT_V5
+
+// Slot of topic in s_topics, or a free one, -1 if all are taken
+static int topic_slot(const char *topic) {
+  for (int i = 0; i < TOPIC_ALIAS_MAX; i++) {
+    if (s_topics[i].topic == NULL || strcmp(s_topics[i].topic, topic) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int transport_publish(const char *topic, const char *data, int len, int qos, int64_t seq) {
+  int slot = topic_slot(topic);
+  bool reused = slot >= 0 && s_topics[slot].topic != NULL;
+  esp_mqtt5_publish_property_config_t property = {
+    .topic_alias = reused ? slot + 1 : 0,
+  };
+
+  char seq_str[12];
+  esp_mqtt5_user_property_item_t items[2] = { { "format", PAYLOAD_FORMAT_VERSION } };
+  int item_count = 1;
+  if (seq >= 0) {
+    snprintf(seq_str, sizeof(seq_str), "%lu", (unsigned long)seq);
+    items[item_count++] = (esp_mqtt5_user_property_item_t){ "seq", seq_str };
+  }
+  esp_mqtt5_client_set_user_property(&property.user_property, items, item_count);
+
+  esp_err_t err = esp_mqtt5_client_set_publish_property(client, &property);
+  if (err != ESP_OK && property.topic_alias != 0) {
+    // The broker takes fewer aliases; the topic goes out in full
+    property.topic_alias = 0;
+    reused = false;
+    slot = -1;
+    err = esp_mqtt5_client_set_publish_property(client, &property);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "MQTT5 PUBLISH PROPERTIES NOT SET");
+  }
+
+  // Once the broker has the alias, the topic name can be left out
+  bool aliased = reused && s_topics[slot].aliased;
+  int msg_id = esp_mqtt_client_publish(client, aliased ? "" : topic, data, len, qos, 0);
+  esp_mqtt5_client_delete_user_property(property.user_property);
+
+  if (msg_id >= 0 && slot >= 0) {
+    s_topics[slot].topic = topic;
+    s_topics[slot].aliased = reused;
+  }
+  return msg_id;
+}
+
+#else
+
+int transport_publish(const char *topic, const char *data, int len, int qos, int64_t seq) {
+  return esp_mqtt_client_publish(client, topic, data, len, qos, 0);
+}
+
+#endif
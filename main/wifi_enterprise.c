@@ -0,0 +1,100 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_eap_client.h"
+
+#include "ap_store.h"
+#include "device_certs.h"
+#include "wifi_enterprise.h"
+
+#ifdef CONFIG_EAP_SERVER_CA_RADIUS
+#include "radius_ca.h"
+#endif
+
+#ifdef CONFIG_WIFI_ENTERPRISE
+
+static const char *TAG = "FOSSOR";
+
+static bool s_enterprise_enabled;
+
+void wifi_enterprise_init(void) {
+  esp_eap_client_set_identity((const unsigned char *)CONFIG_EAP_IDENTITY, strlen(CONFIG_EAP_IDENTITY));
+
+  #ifdef CONFIG_WIFI_AUTH_EAP_TLS
+    // Reuse the device certificate that authenticates us to the broker
+    esp_eap_client_set_certificate_and_key((const unsigned char *)const_cert_pem, strlen(const_cert_pem) + 1,
+                                           (const unsigned char *)const_private_key, strlen(const_private_key) + 1,
+                                           NULL, 0);
+  #else
+    esp_eap_client_set_username((const unsigned char *)CONFIG_EAP_USERNAME, strlen(CONFIG_EAP_USERNAME));
+    esp_eap_client_set_password((const unsigned char *)CONFIG_EAP_PASSWORD, strlen(CONFIG_EAP_PASSWORD));
+  #endif
+
+  #if defined(CONFIG_EAP_SERVER_CA_RADIUS)
+    esp_eap_client_set_ca_cert(certs_radius_CA_crt, strlen((const char *)certs_radius_CA_crt) + 1);
+  #elif defined(CONFIG_EAP_SERVER_CA_BROKER)
+    esp_eap_client_set_ca_cert((const unsigned char *)root_CA_crt, strlen(root_CA_crt) + 1);
+  #else
+    ESP_LOGW(TAG, "RADIUS SERVER NOT CHECKED");
+  #endif
+
+  // There is no SNTP before association, so certificate dates can't be checked
+  esp_eap_client_set_disable_time_check(true);
+
+  // Also keeps SmartConfig from starting, as the store is never empty
+  if (ap_store_find((const uint8_t *)CONFIG_EAP_SSID) < 0) {
+    ap_store_add((const uint8_t *)CONFIG_EAP_SSID, (const uint8_t *)"");
+  }
+  ESP_LOGI(TAG, "Enterprise Wi-Fi configured for %s", CONFIG_EAP_SSID);
+}
+
+void wifi_enterprise_apply(wifi_config_t *wifi_config) {
+  bool enterprise = strncmp((const char *)wifi_config->sta.ssid, CONFIG_EAP_SSID, sizeof(wifi_config->sta.ssid)) == 0;
+  if (enterprise) {
+    // 802.11w management frame protection, which WPA3-Enterprise requires.
+    // It has nothing to do with key caching. Nothing here sets up PMKSA
+    // caching or OKC: a reconnect skips 802.1X only if the IDF supplicant
+    // still holds a PMKSA for that same BSSID. Fast transition (802.11r)
+    // skips it when roaming between FT-capable APs of the ESS.
+    wifi_config->sta.pmf_cfg.capable = true;
+    #ifdef CONFIG_ESP_WIFI_11R_SUPPORT
+      wifi_config->sta.ft_enabled = 1;
+    #endif
+  }
+
+  // Only touch the supplicant when switching between 802.1X and PSK
+  if (enterprise != s_enterprise_enabled) {
+    if (enterprise) {
+      esp_wifi_sta_enterprise_enable();
+    } else {
+      esp_wifi_sta_enterprise_disable();
+    }
+    s_enterprise_enabled = enterprise;
+  }
+}
+
+#else
+
+void wifi_enterprise_init(void) {
+}
+
+void wifi_enterprise_apply(wifi_config_t *wifi_config) {
+}
+
+#endif
@@ -0,0 +1,28 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "esp_wifi.h"
+
+// Load EAP identity, credentials and the server CA into the supplicant and
+// make sure the enterprise SSID is in the AP store, which means SmartConfig
+// is not started. No-op for WPA2/WPA3-Personal builds.
+void wifi_enterprise_init(void);
+
+// Switch the supplicant between 802.1X and PSK for the AP about to be
+// joined, and enable fast re-association where the build supports it.
+void wifi_enterprise_apply(wifi_config_t *wifi_config);
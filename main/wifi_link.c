@@ -0,0 +1,355 @@
+/*
+   Copyright 2024 Pure DePIN
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_smartconfig.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "esp_wnm.h"
+
+#include "ap_store.h"
+#include "net_link.h"
+#include "phase_trace.h"
+#include "wifi_enterprise.h"
+
+#define AP_SCAN_MAX_RECORDS     16
+// Wait before rescanning once every candidate failed, doubling each round
+#define AP_RETRY_MIN_MS         2000
+#define AP_RETRY_MAX_MS         300000
+
+// Ranked APs from the last scan and the one currently tried or in use
+static ap_candidate_t s_candidates[AP_SCAN_MAX_RECORDS];
+static int s_candidate_count;
+static int s_candidate_next;
+static int s_ap_index = -1;
+static int64_t s_connect_start_us;
+static bool s_ap_scanning;
+static bool s_ap_roaming;
+static bool s_got_ip;
+static bool s_smartconfig_active;
+static esp_timer_handle_t s_retry_timer;
+static uint32_t s_retry_ms;             // Last back-off, 0 after a success
+
+// Written by the event loop before CONN_EV_PROVISIONED is posted
+static smartconfig_event_got_ssid_pswd_t s_provisioned;
+
+static const char *TAG = "FOSSOR";
+
+static void ap_scan_done(void);
+
+// Scan for stored APs before picking one to connect to
+static void start_ap_selection(void)
+{
+  s_ap_scanning = true;
+  if (esp_wifi_scan_start(NULL, false) != ESP_OK) {
+    ESP_LOGW(TAG, "AP scan failed, trying stored APs blind");
+    s_ap_scanning = false;
+    ap_scan_done();
+  }
+}
+
+// Runs in the esp_timer task
+static void retry_timer_cb(void *arg)
+{
+  connectivity_post(CONN_EV_LINK_RETRY, 0);
+}
+
+// Connect to the next ranked candidate, rescanning after a back-off once
+// all have failed
+static void connect_next_ap(void)
+{
+  if (s_candidate_next >= s_candidate_count) {
+    s_retry_ms = s_retry_ms == 0 ? AP_RETRY_MIN_MS : s_retry_ms * 2;
+    if (s_retry_ms > AP_RETRY_MAX_MS) {
+      s_retry_ms = AP_RETRY_MAX_MS;
+    }
+    ESP_LOGI(TAG, "No stored AP joined, rescanning in %lu s", (unsigned long)(s_retry_ms / 1000));
+    esp_timer_start_once(s_retry_timer, s_retry_ms * 1000ULL);
+    return;
+  }
+
+  const ap_candidate_t *c = &s_candidates[s_candidate_next++];
+  const ap_entry_t *ap = ap_store_get(c->index);
+  wifi_config_t wifi_config;
+  bzero(&wifi_config, sizeof(wifi_config_t));
+  memcpy(wifi_config.sta.ssid, ap->ssid, sizeof(wifi_config.sta.ssid));
+  memcpy(wifi_config.sta.password, ap->password, sizeof(wifi_config.sta.password));
+  if (c->channel != 0) {
+    wifi_config.sta.bssid_set = true;
+    wifi_config.sta.channel = c->channel;
+    memcpy(wifi_config.sta.bssid, c->bssid, sizeof(wifi_config.sta.bssid));
+    ESP_LOGI(TAG, "Connecting to %s "MACSTR" (RSSI %d, score %d)", ap->ssid, MAC2STR(c->bssid), c->rssi, c->score);
+  } else {
+    ESP_LOGI(TAG, "Connecting to %s (not seen in scan)", ap->ssid);
+  }
+  #ifdef CONFIG_ESP_WIFI_11KV_SUPPORT
+    wifi_config.sta.rm_enabled = 1;
+    wifi_config.sta.btm_enabled = 1;
+  #endif
+
+  wifi_enterprise_apply(&wifi_config);
+
+  s_ap_index = c->index;
+  s_connect_start_us = esp_timer_get_time();
+  esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+  esp_wifi_connect();
+}
+
+static void ap_scan_done(void)
+{
+  static wifi_ap_record_t records[AP_SCAN_MAX_RECORDS];
+  uint16_t record_count = AP_SCAN_MAX_RECORDS;
+  if (esp_wifi_scan_get_ap_records(&record_count, records) != ESP_OK) {
+    record_count = 0;
+  }
+  s_candidate_count = ap_store_rank(records, record_count, s_candidates, AP_SCAN_MAX_RECORDS);
+  s_candidate_next = 0;
+
+  if (s_got_ip) {
+    #ifdef CONFIG_AP_ROAMING
+      // Roaming check: only move for a clearly stronger AP
+      wifi_ap_record_t current;
+      if (s_candidate_count > 0 && esp_wifi_sta_get_ap_info(&current) == ESP_OK) {
+        if (memcmp(s_candidates[0].bssid, current.bssid, sizeof(current.bssid)) != 0 &&
+            s_candidates[0].rssi >= current.rssi + CONFIG_AP_ROAM_HYSTERESIS) {
+          ESP_LOGI(TAG, "Roaming from "MACSTR" (RSSI %d)", MAC2STR(current.bssid), current.rssi);
+          s_ap_roaming = true;
+          esp_wifi_disconnect();
+          return;
+        }
+        // Stay, and only look again if the signal keeps dropping
+        esp_wifi_set_rssi_threshold(current.rssi - CONFIG_AP_ROAM_HYSTERESIS);
+      }
+    #endif
+    return;
+  }
+
+  if (s_candidate_count == 0) {
+    // Nothing visible (or hidden SSIDs), try every stored AP in turn
+    for (int i = 0; i < ap_store_count() && i < AP_SCAN_MAX_RECORDS; i++) {
+      s_candidates[i] = (ap_candidate_t){ .index = i };
+    }
+    s_candidate_count = ap_store_count() < AP_SCAN_MAX_RECORDS ? ap_store_count() : AP_SCAN_MAX_RECORDS;
+  }
+  connect_next_ap();
+}
+
+static void start_smartconfig(void)
+{
+  ESP_LOGI(TAG, "No saved Wi-Fi credentials, starting SmartConfig...");
+  s_smartconfig_active = true;
+  esp_smartconfig_set_type(SC_TYPE_ESPTOUCH);
+  smartconfig_start_config_t cfg = SMARTCONFIG_START_CONFIG_DEFAULT();
+  esp_smartconfig_start(&cfg);
+}
+
+static void apply_provisioned(void)
+{
+  smartconfig_event_got_ssid_pswd_t *evt = &s_provisioned;
+  wifi_config_t wifi_config;
+  uint8_t ssid[33] = { 0 };
+  uint8_t password[65] = { 0 };
+  uint8_t rvd_data[33] = { 0 };
+
+  bzero(&wifi_config, sizeof(wifi_config_t));
+  memcpy(wifi_config.sta.ssid, evt->ssid, sizeof(wifi_config.sta.ssid));
+  memcpy(wifi_config.sta.password, evt->password, sizeof(wifi_config.sta.password));
+
+  #ifdef CONFIG_SET_MAC_ADDRESS_OF_TARGET_AP
+    wifi_config.sta.bssid_set = evt->bssid_set;
+    if (wifi_config.sta.bssid_set == true) {
+      ESP_LOGI(TAG, "Set MAC address of target AP: "MACSTR" ", MAC2STR(evt->bssid));
+      memcpy(wifi_config.sta.bssid, evt->bssid, sizeof(wifi_config.sta.bssid));
+    }
+  #endif
+
+  memcpy(ssid, evt->ssid, sizeof(evt->ssid));
+  memcpy(password, evt->password, sizeof(evt->password));
+  ESP_LOGI(TAG, "SSID:%s", ssid);
+  ESP_LOGI(TAG, "PASSWORD:%s", password);
+  if (evt->type == SC_TYPE_ESPTOUCH_V2) {
+    esp_smartconfig_get_rvd_data(rvd_data, sizeof(rvd_data));
+    ESP_LOGI(TAG, "RVD_DATA:");
+    for (int i=0; i<33; i++) {
+      printf("%02x ", rvd_data[i]);
+    }
+    printf("\n");
+  }
+
+  s_ap_index = ap_store_add(ssid, password);
+  s_connect_start_us = esp_timer_get_time();
+  wifi_enterprise_apply(&wifi_config);
+
+  esp_wifi_disconnect();
+  esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+  esp_wifi_connect();
+}
+
+int net_link_rssi(void)
+{
+  wifi_ap_record_t ap;
+  return esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+}
+
+void net_link_handle(const conn_event_t *event)
+{
+  switch (event->id) {
+    case CONN_EV_WIFI_START: {
+      // Check if there are saved Wi-Fi credentials
+      wifi_config_t wifi_config;
+      esp_err_t err = esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+      if (ap_store_count() == 0 && err == ESP_OK && strlen((char*)wifi_config.sta.ssid) > 0) {
+        // Credentials from before the AP store existed, migrate them
+        ap_store_add(wifi_config.sta.ssid, wifi_config.sta.password);
+      }
+      if (ap_store_count() > 0) {
+        // There are saved credentials, pick the best AP and connect
+        ESP_LOGI(TAG, "Found %d saved Wi-Fi networks, scanning...", ap_store_count());
+        start_ap_selection();
+      } else {
+        start_smartconfig();
+      }
+      break;
+    }
+    case CONN_EV_DISCONNECTED:
+      if (s_smartconfig_active || ap_store_count() == 0) {
+        esp_wifi_connect();
+      } else if (s_ap_roaming) {
+        // Candidates were just ranked by the roaming scan
+        s_ap_roaming = false;
+        s_got_ip = false;
+        connect_next_ap();
+      } else if (s_got_ip) {
+        // Lost an established link, the best AP may have changed
+        s_got_ip = false;
+        start_ap_selection();
+      } else {
+        ap_store_record_result(s_ap_index, false, 0);
+        connect_next_ap();
+      }
+      break;
+    case CONN_EV_SCAN_DONE:
+      if (s_ap_scanning) {
+        s_ap_scanning = false;
+        ap_scan_done();
+      }
+      break;
+    case CONN_EV_RSSI_LOW:
+      #ifdef CONFIG_AP_ROAMING
+        ESP_LOGI(TAG, "Weak signal (RSSI %ld), looking for a better AP...", (long)event->arg);
+        #ifdef CONFIG_ESP_WIFI_WNM_SUPPORT
+          if (esp_wnm_is_btm_supported_connection()) {
+            // Let an 802.11v AP steer us using its 802.11k neighbor list
+            esp_wnm_send_bss_transition_mgmt_query(REASON_RSSI, NULL, 0);
+          }
+        #endif
+        start_ap_selection();
+      #endif
+      break;
+    case CONN_EV_GOT_IP:
+      if (!s_got_ip) {
+        s_got_ip = true;
+        ap_store_record_result(s_ap_index, true, (esp_timer_get_time() - s_connect_start_us) / 1000);
+      }
+      s_retry_ms = 0;
+      #ifdef CONFIG_AP_ROAMING
+        esp_wifi_set_rssi_threshold(CONFIG_AP_ROAM_RSSI_THRESHOLD);
+      #endif
+      break;
+    case CONN_EV_LINK_RETRY:
+      if (!s_got_ip && !s_smartconfig_active) {
+        start_ap_selection();
+      }
+      break;
+    case CONN_EV_PROVISIONED:
+      apply_provisioned();
+      break;
+    case CONN_EV_SC_DONE:
+      ESP_LOGI(TAG, "Smartconfig complete.");
+      s_smartconfig_active = false;
+      esp_smartconfig_stop();
+      break;
+    default:
+      break;
+  }
+}
+
+// Runs in the event loop task: timestamp, then hand over to the queue
+static void event_handler(void* arg, esp_event_base_t event_base,
+                                int32_t event_id, void* event_data)
+{
+  if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+    phase_trace_mark(PHASE_LINK_START);
+    connectivity_post(CONN_EV_WIFI_START, 0);
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+    phase_trace_mark(PHASE_LINK_START);
+    connectivity_post(CONN_EV_DISCONNECTED, 0);
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+    phase_trace_mark(PHASE_SCAN_DONE);
+    connectivity_post(CONN_EV_SCAN_DONE, 0);
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+    phase_trace_mark(PHASE_ASSOCIATED);
+    connectivity_post(CONN_EV_ASSOCIATED, 0);
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_BSS_RSSI_LOW) {
+    wifi_event_bss_rssi_low_t *evt = (wifi_event_bss_rssi_low_t *)event_data;
+    connectivity_post(CONN_EV_RSSI_LOW, evt->rssi);
+  } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+    phase_trace_mark(PHASE_GOT_IP);
+    connectivity_post(CONN_EV_GOT_IP, 0);
+  } else if (event_base == SC_EVENT && event_id == SC_EVENT_SCAN_DONE) {
+    ESP_LOGI(TAG, "Scan complete.");
+  } else if (event_base == SC_EVENT && event_id == SC_EVENT_FOUND_CHANNEL) {
+    ESP_LOGI(TAG, "Channel found.");
+  } else if (event_base == SC_EVENT && event_id == SC_EVENT_GOT_SSID_PSWD) {
+    ESP_LOGI(TAG, "SSID and password obtained.");
+    memcpy(&s_provisioned, event_data, sizeof(s_provisioned));
+    connectivity_post(CONN_EV_PROVISIONED, 0);
+  } else if (event_base == SC_EVENT && event_id == SC_EVENT_SEND_ACK_DONE) {
+    connectivity_post(CONN_EV_SC_DONE, 0);
+  }
+}
+
+void net_link_start(void)
+{
+  esp_netif_init();
+  esp_event_loop_create_default();
+  esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
+  assert(sta_netif);
+
+  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+  esp_wifi_init(&cfg);
+  // Credentials live in the AP store, don't rewrite flash on every attempt
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  ap_store_load();
+  wifi_enterprise_init();
+
+  const esp_timer_create_args_t retry_args = {
+    .callback = retry_timer_cb,
+    .name = "ap_retry",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&retry_args, &s_retry_timer));
+
+  esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL);
+  esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL);
+  esp_event_handler_register(SC_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL);
+
+  esp_wifi_set_mode(WIFI_MODE_STA);
+  esp_wifi_start();
+}
@@ -0,0 +1,289 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Pure DePIN
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Stand-in CoAP over DTLS 1.2 server.
+
+Takes the place of CONFIG_COAP_SERVER_URI for local tests of the CoAP
+transport (main/transport_coap.c). It requires the client certificate,
+answers every confirmable POST with a piggybacked 2.04 Changed, and keeps
+associations, so a device can send later samples without a handshake.
+Sessions resume by ticket, as OpenSSL does by default, or with
+--no-tickets from the server's session cache.
+Each request is printed with the association's traffic so far.
+
+Python's ssl module has no DTLS, so this needs pyOpenSSL. The certificates
+are the fleet simulator's (../fleet_sim/gen_certs.sh).
+"""
+
+import argparse
+import hashlib
+import hmac
+import os
+import select
+import socket
+import struct
+import time
+
+from OpenSSL import SSL
+from OpenSSL._util import lib as _lib
+
+MTU = 1280                      # COAP_MTU in main/transport_coap.c
+IDLE_S = 24 * 3600              # Associations unused this long are dropped
+DTLS1_2_VERSION = 0xfefd        # Not among pyOpenSSL's constants
+
+COAP_VERSION = 1
+COAP_CON, COAP_NON, COAP_ACK, COAP_RST = range(4)
+COAP_POST = 0x02
+COAP_CHANGED = 0x44             # 2.04
+COAP_BAD_REQUEST = 0x80         # 4.00
+COAP_OPTION_URI_PATH = 11
+
+
+def dtls_records(data):
+    """Split DTLS output into whole records."""
+    while len(data) >= 13:
+        end = 13 + struct.unpack('!H', data[11:13])[0]
+        yield data[:end]
+        data = data[end:]
+
+
+def dtls_datagrams(conn, mtu):
+    """Drain the connection's output as datagrams of at most mtu bytes.
+
+    OpenSSL writes records to a memory BIO back to back. Records are packed
+    into datagrams as mbedTLS does on the device.
+    """
+    out = b''
+    while True:
+        try:
+            out += conn.bio_read(65536)
+        except SSL.WantReadError:
+            break
+    datagram = b''
+    for record in dtls_records(out):
+        if datagram and len(datagram) + len(record) > mtu:
+            yield datagram
+            datagram = b''
+        datagram += record
+    if datagram:
+        yield datagram
+
+
+def session_reused(conn):
+    # pyOpenSSL has no wrapper for it
+    return bool(_lib.SSL_session_reused(conn._ssl))
+
+
+def coap_parse(msg):
+    """Type, code, message ID, token, URI path and payload of a message."""
+    if len(msg) < 4 or msg[0] >> 6 != COAP_VERSION:
+        return None
+    kind, tkl, code = (msg[0] >> 4) & 3, msg[0] & 0xf, msg[1]
+    mid = struct.unpack('!H', msg[2:4])[0]
+    token, pos, option, path = msg[4:4 + tkl], 4 + tkl, 0, []
+
+    def extended(value):
+        nonlocal pos
+        if value == 13:
+            value, pos = 13 + msg[pos], pos + 1
+        elif value == 14:
+            value, pos = 269 + struct.unpack('!H', msg[pos:pos + 2])[0], pos + 2
+        return value
+
+    while pos < len(msg) and msg[pos] != 0xff:
+        delta, length = msg[pos] >> 4, msg[pos] & 0xf
+        pos += 1
+        option += extended(delta)
+        length = extended(length)
+        if option == COAP_OPTION_URI_PATH:
+            path.append(msg[pos:pos + length].decode(errors='replace'))
+        pos += length
+    payload = msg[pos + 1:] if pos < len(msg) else b''
+    return kind, code, mid, token, '/' + '/'.join(path), payload
+
+
+def coap_ack(code, mid, token):
+    return bytes([COAP_VERSION << 6 | COAP_ACK << 4 | len(token), code]) + struct.pack('!H', mid) + token
+
+
+class Association:
+    def __init__(self, conn):
+        self.conn = conn
+        self.established = False
+        self.used = time.monotonic()
+        self.rx_bytes = self.rx_datagrams = self.tx_bytes = self.tx_datagrams = 0
+
+
+class CoapServer:
+    def __init__(self, host, port, cert, key, ca, mtu=MTU, tickets=True, quiet=False):
+        self.mtu = mtu
+        self.quiet = quiet
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind((host, port))
+        self.port = self.sock.getsockname()[1]
+        self.assocs = {}
+        self.secret = os.urandom(32)
+
+        ctx = SSL.Context(SSL.DTLS_METHOD)
+        ctx.set_min_proto_version(DTLS1_2_VERSION)
+        ctx.use_certificate_file(cert)
+        ctx.use_privatekey_file(key)
+        ctx.load_verify_locations(ca)
+        ctx.set_verify(SSL.VERIFY_PEER | SSL.VERIFY_FAIL_IF_NO_PEER_CERT, lambda *args: args[-1])
+        ctx.set_session_id(b'coap_sim')
+        ctx.set_options(SSL.OP_NO_QUERY_MTU | SSL.OP_COOKIE_EXCHANGE)
+        if not tickets:
+            # Resume from the server's session cache instead
+            ctx.set_options(SSL.OP_NO_TICKET)
+        ctx.set_cookie_generate_callback(self.cookie)
+        ctx.set_cookie_verify_callback(lambda conn, cookie: hmac.compare_digest(cookie, self.cookie(conn)))
+        self.ctx = ctx
+
+    def cookie(self, conn):
+        # Stateless: the cookie is a MAC of the peer address
+        return hmac.new(self.secret, repr(self.peer).encode(), hashlib.sha256).digest()[:16]
+
+    def forget(self, peer):
+        # Freed without a shutdown, OpenSSL would drop the session from its
+        # cache too, and the device could not resume it
+        assoc = self.assocs.pop(peer, None)
+        if assoc is not None:
+            assoc.conn.set_shutdown(SSL.SENT_SHUTDOWN | SSL.RECEIVED_SHUTDOWN)
+
+    def log(self, text):
+        if not self.quiet:
+            print(text, flush=True)
+
+    def send(self, peer, assoc, conn):
+        for datagram in dtls_datagrams(conn, self.mtu):
+            self.sock.sendto(datagram, peer)
+            if assoc is not None:
+                assoc.tx_bytes += len(datagram)
+                assoc.tx_datagrams += 1
+
+    def new_association(self, peer, data):
+        # A ClientHello without a valid cookie gets a HelloVerifyRequest
+        # and leaves no state behind
+        conn = SSL.Connection(self.ctx, None)
+        conn.set_ciphertext_mtu(self.mtu)
+        conn.bio_write(data)
+        try:
+            conn.DTLSv1_listen()
+        except SSL.WantReadError:
+            self.send(peer, None, conn)
+            return None
+        except SSL.Error:
+            return None
+        assoc = Association(conn)
+        assoc.rx_bytes, assoc.rx_datagrams = len(data), 1
+        self.assocs[peer] = assoc
+        return assoc
+
+    def handle(self, peer, data):
+        self.peer = peer
+        assoc = self.assocs.get(peer)
+        # A new ClientHello (content type 22, epoch 0) on a known address
+        # replaces its association, as after a device restart
+        if assoc is not None and data[:1] == b'\x16' and data[3:5] == b'\x00\x00' and assoc.established:
+            self.forget(peer)
+            assoc = None
+        if assoc is None:
+            assoc = self.new_association(peer, data)
+            if assoc is None:
+                return
+        else:
+            assoc.conn.bio_write(data)
+            assoc.rx_bytes += len(data)
+            assoc.rx_datagrams += 1
+        assoc.used = time.monotonic()
+
+        try:
+            if not assoc.established:
+                try:
+                    assoc.conn.do_handshake()
+                    assoc.established = True
+                    self.log('DTLS %s:%d %s%s' % (peer[0], peer[1], assoc.conn.get_cipher_name(),
+                                                 ' resumed' if session_reused(assoc.conn) else ''))
+                except SSL.WantReadError:
+                    pass
+            while assoc.established:
+                try:
+                    msg = assoc.conn.recv(65536)
+                except SSL.WantReadError:
+                    break
+                reply = self.request(peer, assoc, msg)
+                if reply is not None:
+                    assoc.conn.send(reply)
+        except SSL.ZeroReturnError:
+            self.log('DTLS %s:%d closed' % peer)
+            self.forget(peer)
+        except SSL.Error as e:
+            self.log('DTLS %s:%d failed: %s' % (peer[0], peer[1], e))
+            self.assocs.pop(peer, None)
+        self.send(peer, assoc, assoc.conn)
+
+    def request(self, peer, assoc, msg):
+        parsed = coap_parse(msg)
+        if parsed is None:
+            return None
+        kind, code, mid, token, path, payload = parsed
+        if kind not in (COAP_CON, COAP_NON):
+            return None
+        ok = code == COAP_POST
+        self.log('%s %s %s [rx=%d bytes/%d datagrams tx=%d bytes/%d datagrams] %s' % (
+            'CON' if kind == COAP_CON else 'NON', 'POST' if ok else 'code %d' % code, path,
+            assoc.rx_bytes, assoc.rx_datagrams, assoc.tx_bytes, assoc.tx_datagrams,
+            payload.decode(errors='replace')))
+        if kind == COAP_CON:
+            return coap_ack(COAP_CHANGED if ok else COAP_BAD_REQUEST, mid, token)
+        return None
+
+    def serve(self, stop=None):
+        while stop is None or not stop.is_set():
+            # Handshake retransmissions, then expiry
+            timeouts = [t for t in (a.conn.DTLSv1_get_timeout() for a in self.assocs.values()
+                                    if not a.established) if t is not None]
+            readable, _, _ = select.select([self.sock], [], [], min(timeouts + [1.0]))
+            if readable:
+                data, peer = self.sock.recvfrom(65536)
+                self.handle(peer, data)
+            now = time.monotonic()
+            for peer, assoc in list(self.assocs.items()):
+                if now - assoc.used > IDLE_S:
+                    self.forget(peer)
+                elif not assoc.established and assoc.conn.DTLSv1_get_timeout() == 0:
+                    assoc.conn.DTLSv1_handle_timeout()
+                    self.send(peer, assoc, assoc.conn)
+
+
+def main():
+    certs = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'fleet_sim', 'certs')
+    p = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    p.add_argument('--host', default='127.0.0.1')
+    p.add_argument('--port', type=int, default=5684)
+    p.add_argument('--cert', default=os.path.join(certs, 'broker.crt'))
+    p.add_argument('--key', default=os.path.join(certs, 'broker.key'))
+    p.add_argument('--ca', default=os.path.join(certs, 'ca.crt'))
+    p.add_argument('--mtu', type=int, default=MTU, help='largest datagram sent')
+    p.add_argument('--no-tickets', action='store_true', help='resume sessions by ID, not by ticket')
+    args = p.parse_args()
+    server = CoapServer(args.host, args.port, args.cert, args.key, args.ca, args.mtu, not args.no_tickets)
+    print('CoAP/DTLS stand-in on %s:%d' % (args.host, server.port), flush=True)
+    server.serve()
+
+
+if __name__ == '__main__':
+    main()
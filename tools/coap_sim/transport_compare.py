@@ -0,0 +1,404 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Pure DePIN
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Bytes and round trips per sample, MQTT over TLS against CoAP over DTLS.
+
+Plays the device's side of one sample on each transport, the way the
+firmware does it:
+
+  mqtt          TCP connect, TLS 1.2 handshake with the client certificate,
+                MQTT CONNECT, PUBLISH at QoS 1, PUBACK, DISCONNECT. Every
+                sample opens a new session (main/transport_mqtt.c).
+  coap-new      DTLS 1.2 handshake with a cookie exchange, then a
+                confirmable POST and its ACK (main/transport_coap.c).
+  coap-live     The POST and its ACK on the association of an earlier
+                sample.
+  coap-resumed  After CONFIG_COAP_SESSION_IDLE_S: close_notify on the old
+                association, an abbreviated handshake on a new one, then
+                the POST.
+
+The CoAP cases run once against a server that resumes sessions by ticket
+and once against one that keeps a session cache (":cache"). An OpenSSL
+server's ticket holds the client certificate, and the ClientHello that
+carries it goes out twice because of the cookie exchange.
+
+Telemetry, which rides on the same session on both transports, is left
+out. Counts are taken at the socket: bytes are TLS and DTLS records above
+TCP and UDP, packets are UDP datagrams and TCP segments (from TCP_INFO, so
+loopback ACK timing applies). Round trips are the times the device waits
+for an answer to something it sent.
+
+By default both servers are stand-ins started in this process on
+localhost: coap_server.py, and a minimal MQTT responder with the same TLS
+setup as ../fleet_sim/mosquitto.conf. --mqtt HOST:PORT uses a real broker
+instead. Needs pyOpenSSL and the certificates from ../fleet_sim/gen_certs.sh.
+"""
+
+import argparse
+import os
+import random
+import select
+import socket
+import ssl
+import statistics
+import struct
+import threading
+
+from OpenSSL import SSL
+
+import coap_server
+
+TOPIC = 'entropy/zero'
+CLIENT_ID = b'ESP32_A1B2C3'     # esp-mqtt's default form, ESP32_ and the MAC's low bytes
+KEEPALIVE = 120                 # esp-mqtt default
+TIMEOUT_S = 5
+
+# IPv4 and UDP headers per datagram; IPv4 and TCP headers per segment,
+# without TCP options, as lwIP sends them after the SYN
+UDP_OVERHEAD = 28
+TCP_OVERHEAD = 40
+
+
+def sample_payload():
+    # sample_arena_encode()
+    return b'{"entropy": %d}' % random.getrandbits(64)
+
+
+class Counter:
+    """Traffic and round trips of one sample."""
+
+    def __init__(self):
+        self.tx_bytes = self.rx_bytes = self.tx_packets = self.rx_packets = 0
+        self.round_trips = 0
+        self.waiting = False    # Sent something since the last receive
+
+    def sent(self, n):
+        self.tx_bytes += n
+        self.waiting = True
+
+    def received(self, n):
+        if self.waiting:
+            self.round_trips += 1
+            self.waiting = False
+        self.rx_bytes += n
+
+
+# MQTT over TLS
+
+def mqtt_string(s):
+    return struct.pack('!H', len(s)) + s
+
+
+def mqtt_packet(kind, body):
+    length, n = bytearray(), len(body)
+    while True:
+        byte, n = n % 128, n // 128
+        length.append(byte | (0x80 if n else 0))
+        if not n:
+            return bytes([kind]) + bytes(length) + body
+
+
+class TlsClient:
+    """TLS over TCP through memory BIOs, so every byte is counted."""
+
+    def __init__(self, addr, ctx, server_name, counter):
+        self.counter = counter
+        self.sock = socket.create_connection(addr, TIMEOUT_S)
+        # SYN, SYN-ACK: the device waits one round trip before the ClientHello
+        counter.round_trips += 1
+        self.incoming, self.outgoing = ssl.MemoryBIO(), ssl.MemoryBIO()
+        self.tls = ctx.wrap_bio(self.incoming, self.outgoing, server_hostname=server_name)
+        self.buffer = b''
+        self.run(self.tls.do_handshake)
+
+    def flush(self):
+        data = self.outgoing.read()
+        if data:
+            self.sock.sendall(data)
+            self.counter.sent(len(data))
+
+    def run(self, op, *args):
+        while True:
+            try:
+                result = op(*args)
+                self.flush()
+                return result
+            except ssl.SSLWantReadError:
+                self.flush()
+                data = self.sock.recv(65536)
+                if not data:
+                    raise ConnectionError('closed by the broker')
+                self.counter.received(len(data))
+                self.incoming.write(data)
+
+    def write(self, data):
+        self.run(self.tls.write, data)
+
+    def read_packet(self):
+        while True:
+            if len(self.buffer) >= 2:
+                length, shift, pos = 0, 0, 1
+                while pos < len(self.buffer):
+                    byte = self.buffer[pos]
+                    length |= (byte & 0x7f) << shift
+                    shift += 7
+                    pos += 1
+                    if not byte & 0x80:
+                        if len(self.buffer) >= pos + length:
+                            packet = self.buffer[0], self.buffer[pos:pos + length]
+                            self.buffer = self.buffer[pos + length:]
+                            return packet
+                        break
+            self.buffer += self.run(self.tls.read, 65536)
+
+    def close(self):
+        # esp-mqtt closes the socket after DISCONNECT without a close_notify.
+        # Wait for the broker's FIN so every segment is in TCP_INFO.
+        self.sock.shutdown(socket.SHUT_WR)
+        while self.sock.recv(65536):
+            pass
+        info = self.sock.getsockopt(socket.IPPROTO_TCP, socket.TCP_INFO, 256)
+        # tcpi_segs_out, tcpi_segs_in of struct tcp_info
+        self.counter.tx_packets, self.counter.rx_packets = struct.unpack_from('II', info, 136)
+        self.sock.close()
+
+
+def mqtt_sample(args, ctx):
+    counter = Counter()
+    client = TlsClient(args.mqtt, ctx, args.server_name, counter)
+    connect = mqtt_string(b'MQTT') + bytes([4, 0x02]) + struct.pack('!H', KEEPALIVE) + mqtt_string(CLIENT_ID)
+    client.write(mqtt_packet(0x10, connect))
+    kind, body = client.read_packet()
+    if kind != 0x20 or body[1] != 0:
+        raise ConnectionError('CONNACK refused')
+    client.write(mqtt_packet(0x32, mqtt_string(TOPIC.encode()) + struct.pack('!H', 1) + sample_payload()))
+    while client.read_packet()[0] != 0x40:
+        pass
+    client.write(b'\xe0\x00')
+    client.close()
+    return counter, client.tls.cipher()[0]
+
+
+class MqttStandIn(threading.Thread):
+    """CONNACK, PUBACK and close on DISCONNECT; enough for one device."""
+
+    def __init__(self, host, cert, key, ca):
+        super().__init__(daemon=True)
+        self.ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        self.ctx.load_cert_chain(cert, key)
+        self.ctx.load_verify_locations(ca)
+        self.ctx.verify_mode = ssl.CERT_REQUIRED
+        self.sock = socket.create_server((host, 0))
+        self.addr = self.sock.getsockname()
+
+    def run(self):
+        while True:
+            conn, _ = self.sock.accept()
+            try:
+                with self.ctx.wrap_socket(conn, server_side=True) as tls:
+                    self.session(tls)
+            except (OSError, ssl.SSLError):
+                pass
+
+    @staticmethod
+    def session(tls):
+        buffer = b''
+        while True:
+            data = tls.recv(65536)
+            if not data:
+                return
+            buffer += data
+            while len(buffer) >= 2 and len(buffer) >= 2 + buffer[1]:
+                kind, body, buffer = buffer[0] >> 4, buffer[2:2 + buffer[1]], buffer[2 + buffer[1]:]
+                if kind == 1:
+                    tls.sendall(b'\x20\x02\x00\x00')
+                elif kind == 3:
+                    topic_len = struct.unpack('!H', body[:2])[0]
+                    tls.sendall(b'\x40\x02' + body[2 + topic_len:4 + topic_len])
+                elif kind == 14:
+                    return
+
+
+# CoAP over DTLS
+
+def coap_post(mid, payload):
+    # transport_publish() in main/transport_coap.c: confirmable POST, no
+    # token, Uri-Path per topic segment, JSON content format
+    msg, option = bytearray([1 << 6 | 0 << 4, 0x02]) + struct.pack('!H', mid), 0
+    for segment in TOPIC.encode().split(b'/'):
+        msg += bytes([(11 - option) << 4 | len(segment)]) + segment
+        option = 11
+    return bytes(msg + bytes([(12 - option) << 4 | 1, 50, 0xff]) + payload)
+
+
+class DtlsClient:
+    """DTLS over a connected UDP socket, as the device's CoAP task runs it."""
+
+    def __init__(self, addr, ctx, server_name, counter, session=None):
+        self.counter = counter
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.connect(addr)
+        self.conn = SSL.Connection(ctx, None)
+        self.conn.set_ciphertext_mtu(coap_server.MTU)
+        self.conn.set_tlsext_host_name(server_name.encode())
+        if session is not None:
+            self.conn.set_session(session)
+        self.conn.set_connect_state()
+        self.run(self.conn.do_handshake)
+
+    def flush(self):
+        for datagram in coap_server.dtls_datagrams(self.conn, coap_server.MTU):
+            self.sock.send(datagram)
+            self.counter.sent(len(datagram))
+            self.counter.tx_packets += 1
+
+    def run(self, op, *args):
+        while True:
+            try:
+                result = op(*args)
+                self.flush()
+                return result
+            except SSL.WantReadError:
+                self.flush()
+                timeout = self.conn.DTLSv1_get_timeout()
+                readable, _, _ = select.select([self.sock], [], [], TIMEOUT_S if timeout is None else timeout)
+                if not readable:
+                    if timeout is None or not self.conn.DTLSv1_handle_timeout():
+                        raise TimeoutError('no answer from the CoAP server')
+                    continue
+                data = self.sock.recv(65536)
+                self.counter.received(len(data))
+                self.counter.rx_packets += 1
+                self.conn.bio_write(data)
+
+    def post(self, mid):
+        self.conn.send(coap_post(mid, sample_payload()))
+        while True:
+            reply = self.run(self.conn.recv, 65536)
+            parsed = coap_server.coap_parse(reply)
+            if parsed and parsed[0] == coap_server.COAP_ACK and parsed[2] == mid:
+                if parsed[1] >> 5 != 2:
+                    raise ConnectionError('POST rejected')
+                return
+
+    def close(self, notify):
+        if notify:
+            self.conn.shutdown()
+            self.flush()
+        self.sock.close()
+
+
+def coap_samples(addr, args, ctx, samples, suffix):
+    """Counters for a new, a live and a resumed association, per sample."""
+    results = {'coap-new' + suffix: [], 'coap-live' + suffix: [], 'coap-resumed' + suffix: []}
+    mid = random.getrandbits(16)
+    cipher = None
+    for _ in range(samples):
+        counter = Counter()
+        client = DtlsClient(addr, ctx, args.server_name, counter)
+        client.post(mid)
+        mid = (mid + 1) & 0xffff
+        results['coap-new' + suffix].append(counter)
+        cipher = client.conn.get_cipher_name()
+
+        counter = Counter()
+        client.counter = counter
+        client.post(mid)
+        mid = (mid + 1) & 0xffff
+        results['coap-live' + suffix].append(counter)
+
+        # The idle association is closed and a new one resumes the session
+        counter = Counter()
+        session = client.conn.get_session()
+        client.counter = counter
+        client.close(notify=True)
+        client = DtlsClient(addr, ctx, args.server_name, counter, session)
+        if not coap_server.session_reused(client.conn):
+            raise ConnectionError('session not resumed')
+        client.post(mid)
+        mid = (mid + 1) & 0xffff
+        results['coap-resumed' + suffix].append(counter)
+        client.close(notify=False)
+    return results, cipher
+
+
+def address(text):
+    host, _, port = text.rpartition(':')
+    return host, int(port)
+
+
+def main():
+    certs = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'fleet_sim', 'certs')
+    p = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    p.add_argument('--samples', type=int, default=20, help='samples per case; the median is reported')
+    p.add_argument('--mqtt', type=address, help='HOST:PORT of an MQTT broker instead of the stand-in')
+    p.add_argument('--coap', type=address, help='HOST:PORT of a CoAP server instead of the stand-in')
+    p.add_argument('--server-name', default='localhost', help='name in the server certificates')
+    p.add_argument('--ca', default=os.path.join(certs, 'ca.crt'))
+    p.add_argument('--cert', default=os.path.join(certs, 'device.crt'))
+    p.add_argument('--key', default=os.path.join(certs, 'device.key'))
+    p.add_argument('--server-cert', default=os.path.join(certs, 'broker.crt'))
+    p.add_argument('--server-key', default=os.path.join(certs, 'broker.key'))
+    args = p.parse_args()
+
+    if args.mqtt is None:
+        broker = MqttStandIn('127.0.0.1', args.server_cert, args.server_key, args.ca)
+        broker.start()
+        args.mqtt = broker.addr
+    coap_servers = {'': args.coap}
+    if args.coap is None:
+        for suffix, tickets in (('', True), (':cache', False)):
+            server = coap_server.CoapServer('127.0.0.1', 0, args.server_cert, args.server_key, args.ca,
+                                            tickets=tickets, quiet=True)
+            threading.Thread(target=server.serve, daemon=True).start()
+            coap_servers[suffix] = ('127.0.0.1', server.port)
+
+    # The device speaks TLS 1.2 (mbedTLS without TLS 1.3) and DTLS 1.2
+    tls_ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    tls_ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+    tls_ctx.load_verify_locations(args.ca)
+    tls_ctx.load_cert_chain(args.cert, args.key)
+    dtls_ctx = SSL.Context(SSL.DTLS_METHOD)
+    dtls_ctx.set_min_proto_version(coap_server.DTLS1_2_VERSION)
+    dtls_ctx.set_max_proto_version(coap_server.DTLS1_2_VERSION)
+    dtls_ctx.set_options(SSL.OP_NO_QUERY_MTU)
+    dtls_ctx.load_verify_locations(args.ca)
+    dtls_ctx.use_certificate_file(args.cert)
+    dtls_ctx.use_privatekey_file(args.key)
+    dtls_ctx.set_verify(SSL.VERIFY_PEER, lambda *a: a[-1])
+
+    mqtt = [mqtt_sample(args, tls_ctx) for _ in range(args.samples)]
+    results = {'mqtt': [counter for counter, _ in mqtt]}
+    for suffix, addr in coap_servers.items():
+        coap, dtls_cipher = coap_samples(addr, args, dtls_ctx, args.samples, suffix)
+        results.update(coap)
+
+    print('TLS %s, DTLS %s, %d samples per case, medians' % (mqtt[0][1], dtls_cipher, args.samples))
+    print()
+    print('| Case | Round trips | Bytes up | Bytes down | Packets up | Packets down | Bytes on the wire |')
+    print('| --- | --- | --- | --- | --- | --- | --- |')
+    for case, counters in results.items():
+        median = lambda field: int(statistics.median(getattr(c, field) for c in counters))
+        overhead = TCP_OVERHEAD if case == 'mqtt' else UDP_OVERHEAD
+        wire = (median('tx_bytes') + median('rx_bytes') +
+                overhead * (median('tx_packets') + median('rx_packets')))
+        print('| %s | %d | %d | %d | %d | %d | %d |' % (case, median('round_trips'), median('tx_bytes'),
+                                                        median('rx_bytes'), median('tx_packets'),
+                                                        median('rx_packets'), wire))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Pure DePIN
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Decode deferred log records (CONFIG_APP_LOG_DEFERRED_HEX).
+
+Reads a captured serial log, e.g. from `idf.py monitor`, and prints its
+"DLOG <hex>" lines as text. Format strings are taken from main/dlog.h, so
+use the dlog.h of the firmware that produced the log.
+
+    tools/dlog_decode.py monitor.log
+    idf.py monitor | tools/dlog_decode.py
+"""
+
+import os
+import re
+import struct
+import sys
+
+HEADER = os.path.join(os.path.dirname(__file__), '..', 'main', 'dlog.h')
+RECORD = struct.Struct('<IHH3I')  # dlog_record_t
+
+
+def load_formats(path):
+    with open(path) as f:
+        text = f.read()
+    return [fmt for _, fmt in re.findall(r'X\((DLOG_\w+),\s*"((?:[^"\\]|\\.)*)"\)', text)]
+
+
+def to_python(fmt, args):
+    # %ld takes a signed value; other conversions print the raw 32-bit word
+    out = []
+    specs = re.findall(r'%[-0-9]*l?([udxX])', fmt)
+    for spec, arg in zip(specs, args):
+        out.append(arg - (1 << 32) if spec == 'd' and arg & 0x80000000 else arg)
+    return re.sub(r'%([-0-9]*)l?([udxX])', r'%\1\2', fmt).replace('%u', '%d') % tuple(out)
+
+
+def main():
+    formats = load_formats(HEADER)
+    source = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    last_seq = None
+    for line in source:
+        m = re.search(r'DLOG ([0-9a-f]{%d})' % (2 * RECORD.size), line)
+        if not m:
+            continue
+        ts, msg_id, seq, *args = RECORD.unpack(bytes.fromhex(m.group(1)))
+        if last_seq is not None and seq != (last_seq + 1) & 0xffff:
+            print('... %d entries lost' % ((seq - last_seq - 1) & 0xffff))
+        last_seq = seq
+        text = to_python(formats[msg_id], args) if msg_id < len(formats) else 'unknown id %d' % msg_id
+        print('I (%d) FOSSOR: %s' % (ts, text))
+
+
+if __name__ == '__main__':
+    main()
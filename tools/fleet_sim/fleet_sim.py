@@ -0,0 +1,369 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Pure DePIN
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Fleet load simulator.
+
+Runs thousands of virtual devices against a local broker. Each one repeats
+the firmware's publish cycle (main/connectivity.c): wait an exponentially
+distributed delay, open a TLS connection with the client certificate, MQTT
+CONNECT, PUBLISH the sample at QoS 1, wait for PUBACK, DISCONNECT and close.
+
+This is not the firmware's code. The packets are built from the firmware's
+configuration instead: the topic, the mean delay, MQTT 5 and its session
+and publish properties, and batching, read from --sdkconfig or else from
+the defaults in main/Kconfig.projbuild. With batching every session carries
+a full batch, the most a poor link leads to. See README.md next to this
+file for what is not simulated.
+
+Time is compressed: with --compression 3600 the firmware's 60 minute mean
+delay becomes one second. --start storm lets every device run its first
+cycle at once, the worst case after a fleet-wide restart.
+
+Reports the broker's connection rate, the broker CPU time per session (pass
+--broker-pid, mostly the TLS handshake) and CONNACK/PUBACK tail latency.
+Devices are split over --workers processes, and the simulator's own CPU use
+is reported, so a run limited by the client rather than the broker shows.
+Only the standard library is used; see README.md next to this file.
+"""
+
+import argparse
+import asyncio
+import concurrent.futures
+import json
+import os
+import random
+import re
+import resource
+import ssl
+import struct
+import sys
+import time
+
+MAIN = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'main')
+KEEPALIVE = 120                 # esp-mqtt default
+
+
+def kconfig_defaults(path):
+    # The first unconditional default of each option, which is what a build
+    # without sdkconfig or presets gets
+    values, name = {}, None
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'\s*(?:menu)?config (\w+)', line)
+            if m:
+                name = 'CONFIG_' + m.group(1)
+                continue
+            m = re.match(r'\s*default ("(?:[^"\\]|\\.)*"|\S+)\s*$', line)
+            if m and name and name not in values:
+                values[name] = m.group(1)
+    return values
+
+
+def read_sdkconfig(path):
+    values = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'(CONFIG_\w+)=(.*)$', line.strip())
+            if m:
+                values[m.group(1)] = m.group(2)
+            m = re.match(r'# (CONFIG_\w+) is not set', line.strip())
+            if m:
+                values[m.group(1)] = 'n'
+    return values
+
+
+class Firmware:
+    """What the firmware would send, from its configuration"""
+
+    def __init__(self, sdkconfig=None):
+        config = kconfig_defaults(os.path.join(MAIN, 'Kconfig.projbuild'))
+        if sdkconfig:
+            config.update(read_sdkconfig(sdkconfig))
+        enabled = lambda name: config.get(name) == 'y'
+        number = lambda name: int(config[name])
+        if enabled('CONFIG_TRANSPORT_COAP'):
+            sys.exit('fleet_sim: the build uses CoAP; see tools/coap_sim')
+        with open(os.path.join(MAIN, 'transport.h')) as f:
+            self.format_version = re.search(r'#define PAYLOAD_FORMAT_VERSION\s+"(\w+)"', f.read()).group(1).encode()
+
+        self.topic = config['CONFIG_MQTT_TOPIC'].strip('"').encode()
+        self.average_delay_minutes = number('CONFIG_AVERAGE_DELAY_MINUTES')
+        self.mqtt5 = enabled('CONFIG_MQTT_V5')
+        self.session_expiry_s = number('CONFIG_MQTT_V5_SESSION_EXPIRY_S') if self.mqtt5 else 0
+        self.receive_maximum = number('CONFIG_MQTT_V5_RECEIVE_MAXIMUM') if self.mqtt5 else 0
+        # RATE_CTL_BATCH_MAX in main/rate_ctl.h
+        self.batch = 1
+        if enabled('CONFIG_ADAPTIVE_BATCHING'):
+            self.batch = min(number('CONFIG_BATCH_MAX'), max(number('CONFIG_SAMPLE_ARENA_SLOTS') // 2, 1))
+
+    def describe(self):
+        return {'topic': self.topic.decode(), 'mqtt5': self.mqtt5, 'batch': self.batch,
+                'average_delay_minutes': self.average_delay_minutes}
+
+    def connect_packet(self, client_id):
+        if not self.mqtt5:
+            var = mqtt_string(b'MQTT') + bytes([4, 0x02]) + struct.pack('!H', KEEPALIVE)
+        else:
+            # A session that expires later is resumed, not started clean
+            flags = 0x00 if self.session_expiry_s else 0x02
+            props = b''
+            if self.session_expiry_s:
+                props += b'\x11' + struct.pack('!I', self.session_expiry_s)
+            props += b'\x21' + struct.pack('!H', self.receive_maximum)
+            var = mqtt_string(b'MQTT') + bytes([5, flags]) + struct.pack('!H', KEEPALIVE)
+            var += remaining_length(len(props)) + props
+        body = var + mqtt_string(client_id)
+        return b'\x10' + remaining_length(len(body)) + body
+
+    def publish_packet(self, packet_id, seq, entropy, ages_ms):
+        # main/sample_arena.c: one sample as is, several as a batch
+        if len(entropy) == 1:
+            topic, payload = self.topic, b'{"entropy": %d}' % entropy[0]
+        else:
+            topic = self.topic + b'/batch'
+            payload = b'[' + b','.join(b'{"entropy": %d, "age_ms": %d}' % sample
+                                       for sample in zip(entropy, ages_ms)) + b']'
+        body = mqtt_string(topic) + struct.pack('!H', packet_id)
+        if self.mqtt5:
+            # main/transport_mqtt.c: the payload format and the oldest
+            # sample's sequence number. A topic is aliased only from its
+            # second use on a connection, which a session does not reach.
+            props = (b'\x26' + mqtt_string(b'format') + mqtt_string(self.format_version) +
+                     b'\x26' + mqtt_string(b'seq') + mqtt_string(b'%d' % seq))
+            body += remaining_length(len(props)) + props
+        body += payload
+        return b'\x32' + remaining_length(len(body)) + body
+
+
+def remaining_length(n):
+    out = bytearray()
+    while True:
+        byte, n = n % 128, n // 128
+        out.append(byte | (0x80 if n else 0))
+        if not n:
+            return bytes(out)
+
+
+def mqtt_string(s):
+    return struct.pack('!H', len(s)) + s
+
+
+async def read_packet(reader):
+    header = await reader.readexactly(1)
+    length, shift = 0, 0
+    while True:
+        byte = (await reader.readexactly(1))[0]
+        length |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    return header[0], await reader.readexactly(length)
+
+
+class Stats:
+    def __init__(self):
+        self.sessions = 0
+        self.failures = 0
+        self.connects_per_second = {}
+        self.connack_ms = []
+        self.puback_ms = []
+
+    def connect_attempt(self):
+        second = int(time.monotonic())
+        self.connects_per_second[second] = self.connects_per_second.get(second, 0) + 1
+
+
+async def session(args, ctx, device, stats, seq, ages_ms):
+    stats.connect_attempt()
+    start = time.monotonic()
+    writer = None
+    try:
+        reader, writer = await asyncio.wait_for(
+            asyncio.open_connection(args.host, args.port, ssl=ctx, server_hostname=args.server_name),
+            args.timeout)
+        writer.write(args.firmware.connect_packet(b'ESP32_%06X' % device))
+        kind, body = await asyncio.wait_for(read_packet(reader), args.timeout)
+        if kind != 0x20 or body[1] != 0:
+            raise ConnectionError('CONNACK refused')
+        connack = time.monotonic()
+
+        entropy = [random.getrandbits(64) for _ in ages_ms]
+        writer.write(args.firmware.publish_packet(1, seq, entropy, ages_ms))
+        while True:
+            kind, body = await asyncio.wait_for(read_packet(reader), args.timeout)
+            if kind == 0x40 and struct.unpack('!H', body[:2])[0] == 1:
+                break
+        puback = time.monotonic()
+
+        writer.write(b'\xe0\x00')
+        await writer.drain()
+        stats.sessions += 1
+        stats.connack_ms.append((connack - start) * 1000)
+        stats.puback_ms.append((puback - connack) * 1000)
+    except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ConnectionError, ssl.SSLError):
+        stats.failures += 1
+        return False
+    finally:
+        if writer is not None:
+            writer.close()
+    return True
+
+
+def next_samples(args, mean_s):
+    # Delay until a session has a full batch, and each sample's age then in
+    # firmware milliseconds
+    gaps = [random.expovariate(1 / mean_s) for _ in range(args.firmware.batch)]
+    ages_ms, age = [], sum(gaps)
+    for gap in gaps:
+        age -= gap
+        ages_ms.append(int(age * args.compression * 1000))
+    return sum(gaps), ages_ms
+
+
+async def device_loop(args, ctx, device, stats, deadline):
+    mean_s = args.firmware.average_delay_minutes * 60 / args.compression
+    delay, ages_ms = next_samples(args, mean_s)
+    if args.start == 'storm':
+        delay = random.uniform(0, args.storm_window)
+    seq = 0
+    while time.monotonic() + delay < deadline:
+        await asyncio.sleep(delay)
+        # Samples stay pending after a failed session, as on the device
+        if await session(args, ctx, device, stats, seq, ages_ms):
+            seq += len(ages_ms)
+        delay, ages_ms = next_samples(args, mean_s)
+
+
+def broker_cpu_seconds(pid):
+    if pid is None:
+        return None
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    # utime and stime, fields 14 and 15 of stat(5)
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def percentiles(values):
+    if not values:
+        return {}
+    values = sorted(values)
+    pick = lambda p: round(values[min(len(values) - 1, int(len(values) * p))], 2)
+    return {'p50': pick(0.50), 'p95': pick(0.95), 'p99': pick(0.99), 'p999': pick(0.999), 'max': round(values[-1], 2)}
+
+
+async def run_devices(args, devices, start_at):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    ctx.load_verify_locations(args.ca)
+    ctx.load_cert_chain(args.cert, args.key)
+
+    stats = Stats()
+    # Workers start together, whenever their process came up
+    await asyncio.sleep(max(0, start_at - time.monotonic()))
+    cpu_start = time.process_time()
+    deadline = start_at + args.duration
+    await asyncio.gather(*(device_loop(args, ctx, d, stats, deadline) for d in devices))
+    return {
+        'sessions': stats.sessions,
+        'failures': stats.failures,
+        'connects_per_second': stats.connects_per_second,
+        'connack_ms': stats.connack_ms,
+        'puback_ms': stats.puback_ms,
+        'cpu_s': time.process_time() - cpu_start,
+        'elapsed_s': time.monotonic() - start_at,
+    }
+
+
+def worker(args, devices, start_at):
+    # One socket per device in flight
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+    return asyncio.run(run_devices(args, devices, start_at))
+
+
+def run(args):
+    # Device i goes to worker i % workers, so client IDs stay unique
+    shares = [range(w, args.devices, args.workers) for w in range(args.workers)]
+    cpu_start = broker_cpu_seconds(args.broker_pid)
+    if args.workers == 1:
+        results = [worker(args, shares[0], time.monotonic())]
+    else:
+        start_at = time.monotonic() + 2.0
+        with concurrent.futures.ProcessPoolExecutor(args.workers) as pool:
+            results = list(pool.map(worker, [args] * args.workers, shares, [start_at] * args.workers))
+    cpu_end = broker_cpu_seconds(args.broker_pid)
+
+    rates = {}
+    for result in results:
+        for second, n in result['connects_per_second'].items():
+            rates[second] = rates.get(second, 0) + n
+    elapsed = max(result['elapsed_s'] for result in results)
+    sessions = sum(result['sessions'] for result in results)
+    # A worker near 1.0 was busy the whole run: the client, not the broker,
+    # set the pace. Add workers until it drops.
+    worker_util = max(result['cpu_s'] / result['elapsed_s'] for result in results)
+    report = {
+        'firmware': args.firmware.describe(),
+        'devices': args.devices,
+        'workers': args.workers,
+        'compression': args.compression,
+        'start': args.start,
+        'elapsed_s': round(elapsed, 1),
+        'sessions': sessions,
+        'failures': sum(result['failures'] for result in results),
+        'connects_per_s': {'mean': round(sum(rates.values()) / elapsed, 1), 'peak': max(rates.values(), default=0)},
+        'connack_ms': percentiles([v for result in results for v in result['connack_ms']]),
+        'puback_ms': percentiles([v for result in results for v in result['puback_ms']]),
+        'client_cpu_s': round(sum(result['cpu_s'] for result in results), 2),
+        'client_worker_util_max': round(worker_util, 2),
+    }
+    if cpu_start is not None:
+        cpu = cpu_end - cpu_start
+        report['broker_cpu_s'] = round(cpu, 2)
+        report['broker_cpu_ms_per_session'] = round(cpu * 1000 / max(sessions, 1), 3)
+    print(json.dumps(report))
+    if worker_util > 0.9:
+        print('fleet_sim: a worker was %d%% busy, results are limited by the simulator; raise --workers'
+              % (worker_util * 100), file=sys.stderr)
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    certs = os.path.join(here, 'certs')
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument('--devices', type=int, default=1000)
+    p.add_argument('--duration', type=float, default=60, help='wall-clock seconds to run')
+    p.add_argument('--compression', type=float, default=3600, help='firmware seconds per simulated second')
+    p.add_argument('--start', choices=['poisson', 'storm'], default='poisson')
+    p.add_argument('--storm-window', type=float, default=1.0, help='seconds over which a storm starts')
+    p.add_argument('--host', default='127.0.0.1')
+    p.add_argument('--port', type=int, default=8883)
+    p.add_argument('--server-name', default='localhost', help='name in the broker certificate')
+    p.add_argument('--ca', default=os.path.join(certs, 'ca.crt'))
+    p.add_argument('--cert', default=os.path.join(certs, 'device.crt'))
+    p.add_argument('--key', default=os.path.join(certs, 'device.key'))
+    p.add_argument('--timeout', type=float, default=30)
+    p.add_argument('--broker-pid', type=int, help='broker process, for CPU time per session')
+    p.add_argument('--workers', type=int, default=1, help='client processes; up to one per spare core')
+    p.add_argument('--sdkconfig', help='firmware build to simulate; main/Kconfig.projbuild defaults otherwise')
+    args = p.parse_args()
+    args.firmware = Firmware(args.sdkconfig)
+    if args.workers < 1 or args.workers > args.devices:
+        p.error('--workers must be between 1 and --devices')
+    run(args)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Test CA, broker and device certificates for the fleet simulator. Never
+# use them outside a local test setup.
+set -e
+cd "$(dirname "$0")"
+mkdir -p certs
+cd certs
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj "/CN=Fleet Test CA" \
+  -keyout ca.key -out ca.crt
+for name in broker device; do
+  cn=localhost
+  [ "$name" = device ] && cn=fleet-device
+  openssl req -newkey rsa:2048 -nodes -subj "/CN=$cn" -keyout $name.key -out $name.csr
+  openssl x509 -req -in $name.csr -CA ca.crt -CAkey ca.key -CAcreateserial -days 365 \
+    -extfile /dev/stdin -out $name.crt <<EXT
+subjectAltName=DNS:$cn
+EXT
+  rm $name.csr
+done
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Pure DePIN
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Compare measurements from two captured serial logs.
+
+Takes a log from a baseline build and one from a changed build, e.g. with
+and without reduced-RAM mbedTLS options, and prints the median and 90th
+percentile of each measurement with the difference, as a Markdown table
+for the README.
+
+    tools/log_compare.py baseline.log tls_lowmem.log
+
+Measurements:
+  session_peak  heap taken by one session, from the HEAP lines of
+                CONFIG_TASK_STACK_REPORT
+  bench <name>  one per CONFIG_BENCH_MODE result: the median for timed
+                benchmarks, the rate for the pipeline ones. Concatenate
+                several runs into one log to get percentiles across runs.
+  phase <name>  p50 of each CONFIG_PHASE_TRACE report, in microseconds
+"""
+
+import re
+import sys
+
+# A pattern with two groups names the measurement after its first one
+MEASUREMENTS = [
+    ('session_peak', re.compile(r'HEAP free=\d+ min=\d+ session_peak=(\d+)')),
+    ('bench', re.compile(r'BENCH \{"name":"(\w+)".*?"(?:median|rate)":(\d+)')),
+    ('phase', re.compile(r'PHASE (\w+)\s+n=\d+ p50=(\d+)us')),
+]
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p * len(values)))]
+
+
+def collect(path):
+    found = {}
+    with open(path, errors='replace') as f:
+        for line in f:
+            for name, pattern in MEASUREMENTS:
+                m = pattern.search(line)
+                if m and pattern.groups == 2:
+                    found.setdefault('%s %s' % (name, m.group(1)), []).append(int(m.group(2)))
+                elif m:
+                    found.setdefault(name, []).append(int(m.group(1)))
+    return found
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    base, changed = collect(sys.argv[1]), collect(sys.argv[2])
+    print('| Measurement | n | Baseline median | Changed median | Difference | Baseline p90 | Changed p90 |')
+    print('| --- | --- | --- | --- | --- | --- | --- |')
+    for name in list(base) + [name for name in changed if name not in base]:
+        a, b = base.get(name), changed.get(name)
+        if not a or not b:
+            print('| %s | missing in %s | | | | | |' % (name, sys.argv[1] if not a else sys.argv[2]))
+            continue
+        ma, mb = percentile(a, 0.5), percentile(b, 0.5)
+        diff = '%+d (%+.1f%%)' % (mb - ma, 100.0 * (mb - ma) / ma) if ma else '%+d' % (mb - ma)
+        print('| %s | %d/%d | %d | %d | %s | %d | %d |' % (name, len(a), len(b), ma, mb, diff,
+                                                           percentile(a, 0.9), percentile(b, 0.9)))
+
+
+if __name__ == '__main__':
+    main()
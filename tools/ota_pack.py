@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Pure DePIN
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Build an update for CONFIG_OTA_UPDATE.
+
+Packs build/<project>.bin into the container main/ota.c downloads. With
+--base, the payload is a bsdiff-style patch against that image, which the
+device applies to its running partition. The payload is zlib-compressed
+unless that does not make it smaller.
+
+    tools/ota_pack.py build/fossor.bin fossor.fota
+    tools/ota_pack.py build/fossor.bin fossor.fota --base v1/fossor.bin
+
+Serve the result with status 200 to devices whose X-Fossor-Elf-Sha256
+header matches the base (or any device, for a full image), and 204 to the
+rest. Every container is rebuilt here the way the device does before it is
+written.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+# ota_header_t
+HEADER = struct.Struct('<IBBBBI32s32s')
+MAGIC = 0x41544f46
+FORMAT_VERSION = 1
+ENCODING_FULL, ENCODING_DELTA = 0, 1
+COMPRESSION_NONE, COMPRESSION_ZLIB = 0, 1
+
+# esp_app_desc_t follows the image header and the first segment header
+APP_DESC_OFFSET = 24 + 8
+APP_DESC_MAGIC = 0xABCD5432
+ELF_SHA256_OFFSET = APP_DESC_OFFSET + 144
+
+MATCH_KEY = 8       # Bytes hashed to find a match
+INDEX_STEP = 4      # Base positions indexed
+GIVE_UP = 256       # Stop extending a match after this many bytes without gain
+
+
+def elf_sha256(image):
+    magic, = struct.unpack_from('<I', image, APP_DESC_OFFSET)
+    if magic != APP_DESC_MAGIC:
+        sys.exit('base is not an ESP-IDF app image')
+    return image[ELF_SHA256_OFFSET:ELF_SHA256_OFFSET + 32]
+
+
+def offtout(x):
+    # bsdiff's sign-and-magnitude 64-bit integer
+    return struct.pack('<Q', -x | 1 << 63 if x < 0 else x)
+
+
+def offtin(buf):
+    y, = struct.unpack('<Q', buf)
+    return -(y & ~(1 << 63)) if y & 1 << 63 else y
+
+
+def extend(old, new, o, n):
+    # bsdiff's approximate match: keep the length where matching bytes most
+    # outnumber mismatching ones
+    best, best_len, score, i = 0, 0, 0, 0
+    while o + i < len(old) and n + i < len(new) and i - best_len < GIVE_UP:
+        score += 1 if old[o + i] == new[n + i] else -1
+        i += 1
+        if score > best:
+            best, best_len = score, i
+    return best_len
+
+
+def diff(old, new):
+    """Control triples, diff and extra bytes interleaved (ENDSLEY/BSDIFF43)."""
+    index = {}
+    for p in range(0, len(old) - MATCH_KEY, INDEX_STEP):
+        index.setdefault(old[p:p + MATCH_KEY], p)
+
+    out = bytearray()
+    # Pending match: new[match_new:match_new + match_len] ~ old[match_old:]
+    match_new, match_old, match_len = 0, 0, 0
+
+    def emit(extra_end, next_old):
+        out.extend(offtout(match_len))
+        out.extend(offtout(extra_end - match_new - match_len))
+        out.extend(offtout(next_old - match_old - match_len))
+        out.extend((new[match_new + i] - old[match_old + i]) & 0xff for i in range(match_len))
+        out.extend(new[match_new + match_len:extra_end])
+
+    scan = 0
+    while scan < len(new) - MATCH_KEY:
+        p = index.get(new[scan:scan + MATCH_KEY])
+        length = extend(old, new, p, scan) if p is not None else 0
+        if length < MATCH_KEY:
+            scan += 1
+            continue
+        emit(scan, p)
+        match_new, match_old, match_len = scan, p, length
+        scan += length
+    emit(len(new), match_old + match_len)
+    return bytes(out)
+
+
+def patch(old, payload, size):
+    # Mirrors patch() in main/ota.c
+    new = bytearray()
+    base, pos = 0, 0
+    while len(new) < size:
+        add, copy, seek = (offtin(payload[pos + i:pos + i + 8]) for i in (0, 8, 16))
+        pos += 24
+        if add < 0 or copy < 0 or len(new) + add + copy > size or base + add > len(old):
+            raise ValueError('bad control block')
+        new.extend((payload[pos + i] + old[base + i]) & 0xff for i in range(add))
+        new.extend(payload[pos + add:pos + add + copy])
+        pos += add + copy
+        base += add + seek
+    if pos != len(payload):
+        raise ValueError('trailing patch data')
+    return bytes(new)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('image', help='new app image (build/<project>.bin)')
+    parser.add_argument('output', help='container to write')
+    parser.add_argument('--base', help='app image the devices run now, for a delta update')
+    parser.add_argument('--no-compress', action='store_true', help='never zlib-compress the payload')
+    args = parser.parse_args()
+
+    new = open(args.image, 'rb').read()
+    if args.base:
+        old = open(args.base, 'rb').read()
+        encoding, base_sha256, payload = ENCODING_DELTA, elf_sha256(old), diff(old, new)
+    else:
+        old = None
+        encoding, base_sha256, payload = ENCODING_FULL, bytes(32), new
+
+    compression = COMPRESSION_NONE
+    if not args.no_compress:
+        packed = zlib.compress(payload, 9)
+        if len(packed) < len(payload):
+            compression, payload = COMPRESSION_ZLIB, packed
+
+    header = HEADER.pack(MAGIC, FORMAT_VERSION, encoding, compression, 0, len(new), base_sha256,
+                         hashlib.sha256(new).digest())
+
+    rebuilt = zlib.decompress(payload) if compression == COMPRESSION_ZLIB else payload
+    if encoding == ENCODING_DELTA:
+        rebuilt = patch(old, rebuilt, len(new))
+    if rebuilt != new:
+        sys.exit('container does not rebuild the image')
+
+    with open(args.output, 'wb') as f:
+        f.write(header + payload)
+    size = HEADER.size + len(payload)
+    print('%s: %s%s, %d bytes for a %d byte image (%.1f%%)' % (
+        args.output, 'delta' if encoding == ENCODING_DELTA else 'full',
+        ', zlib' if compression == COMPRESSION_ZLIB else '', size, len(new), 100.0 * size / len(new)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+#
+# Copyright 2024 Pure DePIN
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Size task stacks from a CONFIG_TASK_STACK_REPORT log.
+
+Takes one or more captured serial logs and prints, for every task, the
+lowest unused stack seen and the stack size that leaves MARGIN bytes of it,
+rounded up to 256 bytes, as a Markdown table for the README.
+
+    tools/stack_sizes.py [--margin 512] device.log [...]
+
+ESP-IDF system tasks do not report their size. Give the sdkconfig of the
+build with --sdkconfig to size the ones set there.
+"""
+
+import argparse
+import re
+
+STACK_LINE = re.compile(r'STACK (\S+)\s+(\d+)(?:/\s*(\d+))? bytes unused')
+
+# Where each task's size is set
+SETTINGS = {
+    'conn_task': 'CONFIG_CONN_TASK_STACK_SIZE',
+    'sampler': 'CONFIG_SAMPLER_STACK_SIZE',
+    'ota': 'CONFIG_OTA_STACK_SIZE',
+    'coap': 'CONFIG_COAP_STACK_SIZE',
+    'main': 'CONFIG_ESP_MAIN_TASK_STACK_SIZE',
+    'mqtt_task': 'CONFIG_MQTT_TASK_STACK_SIZE',
+    'sys_evt': 'CONFIG_ESP_SYSTEM_EVENT_TASK_STACK_SIZE',
+    'tiT': 'CONFIG_LWIP_TCPIP_TASK_STACK_SIZE',
+}
+
+
+def read_sdkconfig(path):
+    values = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'(CONFIG_\w+)=(\d+)$', line.strip())
+            if m:
+                values[m.group(1)] = int(m.group(2))
+    return values
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('logs', nargs='+')
+    parser.add_argument('--margin', type=int, default=512, help='bytes left unused at the deepest point')
+    parser.add_argument('--sdkconfig', help='sdkconfig of the build, for the sizes of system tasks')
+    args = parser.parse_args()
+    config = read_sdkconfig(args.sdkconfig) if args.sdkconfig else {}
+
+    unused, size, reports = {}, {}, {}
+    for path in args.logs:
+        with open(path, errors='replace') as f:
+            for line in f:
+                m = STACK_LINE.search(line)
+                if not m:
+                    continue
+                task = m.group(1)
+                unused[task] = min(unused.get(task, int(m.group(2))), int(m.group(2)))
+                reports[task] = reports.get(task, 0) + 1
+                if m.group(3):
+                    size[task] = int(m.group(3))
+                elif SETTINGS.get(task) in config:
+                    size[task] = config[SETTINGS[task]]
+
+    print('| Task | Reports | Size | Lowest unused | Deepest use | Sized with %d B margin | Set in |' % args.margin)
+    print('| --- | --- | --- | --- | --- | --- | --- |')
+    for task in sorted(unused):
+        setting = '`%s`' % SETTINGS[task] if task in SETTINGS else 'not configurable'
+        if task not in size:
+            print('| `%s` | %d | ? | %d B | ? | ? | %s |' % (task, reports[task], unused[task], setting))
+            continue
+        used = size[task] - unused[task]
+        sized = -(-(used + args.margin) // 256) * 256
+        print('| `%s` | %d | %d B | %d B | %d B | %d B | %s |' % (task, reports[task], size[task], unused[task],
+                                                                 used, sized, setting))
+
+
+if __name__ == '__main__':
+    main()